@@ -3,121 +3,3238 @@
 
 #include <cstdio>
 #include <cstdarg>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
 #include <string>
+#include <vector>
 #include <memory>
 #include <clocale>
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <unordered_map>
+#include <list>
 
 #ifdef _WIN32
     #define WIN32_LEAN_AND_MEAN
     #include <windows.h>
     #include <io.h>
-    // Declare Windows console functions
-    extern "C" {
-        int _kbhit(void);
-        int _getch(void);
-        int _getche(void);
-        int _putch(int c);
-        wint_t _getwch(void);
-        wint_t _getwche(void);
+    #ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+        #define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+    #endif
+#else
+    #define _XOPEN_SOURCE_EXTENDED 1
+    #include <ncursesw/ncurses.h>
+    #include <unistd.h>
+    #include <sys/ioctl.h>
+    #include <termios.h>
+    #include <poll.h>
+    #include <locale.h>
+    #include <wchar.h>
+    // From <term.h>, which is left out because its capability macros
+    // (lines, columns, ...) would leak into user code
+    extern "C" int setupterm(const char* term, int fd, int* errret);
+#endif
+
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+namespace conio {
+
+// Colour constants
+enum class Colour {
+    BLACK = 0,
+    BLUE = 1,
+    GREEN = 2,
+    CYAN = 3,
+    RED = 4,
+    MAGENTA = 5,
+    YELLOW = 6,
+    WHITE = 7,
+    BRIGHT_BLACK = 8,
+    BRIGHT_BLUE = 9,
+    BRIGHT_GREEN = 10,
+    BRIGHT_CYAN = 11,
+    BRIGHT_RED = 12,
+    BRIGHT_MAGENTA = 13,
+    BRIGHT_YELLOW = 14,
+    BRIGHT_WHITE = 15
+};
+
+// 24-bit RGB colour
+struct Rgb {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+};
+
+// Entry of the xterm 256-colour palette
+struct Colour256 {
+    uint8_t index;
+};
+
+// How many colours a terminal can show
+enum class ColourDepth {
+    COLOURS_8,
+    COLOURS_16,
+    COLOURS_256,
+    TRUECOLOUR
+};
+
+// Any colour accepted by the drawing functions: one of the 16 Colour
+// constants, a 256-palette entry or an RGB value. Converts implicitly from
+// all three, so existing Colour arguments keep working.
+class ColourSpec {
+public:
+    enum Kind { BASIC = 0, PALETTE = 1, RGB = 2 };
+
+    ColourSpec() : value(static_cast<uint32_t>(Colour::WHITE)) {}
+    ColourSpec(Colour c) : value(static_cast<uint32_t>(c)) {}
+    ColourSpec(Colour256 c) : value((PALETTE << 24) | c.index) {}
+    ColourSpec(Rgb c) : value((RGB << 24) | (c.r << 16) | (c.g << 8) | c.b) {}
+
+    Kind kind() const { return static_cast<Kind>(value >> 24); }
+    Colour basic() const { return static_cast<Colour>(value & 0x0F); }
+    uint8_t index() const { return static_cast<uint8_t>(value & 0xFF); }
+    Rgb rgb() const {
+        Rgb c = { static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value) };
+        return c;
+    }
+    uint32_t raw() const { return value; }
+
+    bool operator==(const ColourSpec& other) const { return value == other.value; }
+    bool operator!=(const ColourSpec& other) const { return value != other.value; }
+
+private:
+    uint32_t value;
+};
+
+// ANSI / xterm index (0-15) of a Colour constant.
+// Our enum: BLACK(0), BLUE(1), GREEN(2), CYAN(3), RED(4), MAGENTA(5), YELLOW(6), WHITE(7)
+// ANSI:     BLACK(0), RED(1),  GREEN(2), YELLOW(3), BLUE(4), MAGENTA(5), CYAN(6),  WHITE(7)
+inline int ansi_index(Colour c) {
+    static const int ansi[8] = { 0, 4, 2, 6, 1, 5, 3, 7 };
+    int val = static_cast<int>(c);
+    return ansi[val % 8] + (val >= 8 ? 8 : 0);
+}
+
+// RGB value of an xterm 256-colour palette entry
+inline Rgb palette_rgb(uint8_t index) {
+    static const uint8_t basic[16][3] = {
+        {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0},
+        {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+        {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+        {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}
+    };
+    static const uint8_t level[6] = { 0, 95, 135, 175, 215, 255 };
+    Rgb c;
+    if (index < 16) {
+        c.r = basic[index][0]; c.g = basic[index][1]; c.b = basic[index][2];
+    } else if (index < 232) {
+        int i = index - 16;
+        c.r = level[i / 36]; c.g = level[(i / 6) % 6]; c.b = level[i % 6];
+    } else {
+        c.r = c.g = c.b = static_cast<uint8_t>(8 + (index - 232) * 10);
+    }
+    return c;
+}
+
+// Nearest 256-palette entry for an RGB colour. Constant time: the colour is
+// snapped to the 6x6x6 cube and to the grey ramp and the closer one is taken.
+inline uint8_t nearest_256(Rgb c) {
+    struct Snap {
+        uint8_t level[256];
+        Snap() {
+            // Cube levels are 0, 95, 135, 175, 215, 255; split at the midpoints
+            for (int v = 0; v < 256; v++) {
+                level[v] = static_cast<uint8_t>(v < 48 ? 0 : v < 115 ? 1 : (v - 35) / 40);
+            }
+        }
+    };
+    static const Snap snap;
+    int ri = snap.level[c.r], gi = snap.level[c.g], bi = snap.level[c.b];
+    uint8_t cube = static_cast<uint8_t>(16 + ri * 36 + gi * 6 + bi);
+
+    int avg = (c.r + c.g + c.b) / 3;
+    int grey_step = avg < 8 ? 0 : avg > 238 ? 23 : (avg - 3) / 10;
+    uint8_t grey = static_cast<uint8_t>(232 + grey_step);
+
+    Rgb pc = palette_rgb(cube), pg = palette_rgb(grey);
+    int dc = (pc.r - c.r) * (pc.r - c.r) + (pc.g - c.g) * (pc.g - c.g) + (pc.b - c.b) * (pc.b - c.b);
+    int dg = (pg.r - c.r) * (pg.r - c.r) + (pg.g - c.g) * (pg.g - c.g) + (pg.b - c.b) * (pg.b - c.b);
+    return dg < dc ? grey : cube;
+}
+
+// Nearest of the 16 Colour constants for a 256-palette entry (table lookup;
+// the table is built once on first use)
+inline Colour nearest_16(uint8_t index) {
+    struct Table {
+        Colour colour[256];
+        Table() {
+            static const Colour by_ansi[16] = {
+                Colour::BLACK, Colour::RED, Colour::GREEN, Colour::YELLOW,
+                Colour::BLUE, Colour::MAGENTA, Colour::CYAN, Colour::WHITE,
+                Colour::BRIGHT_BLACK, Colour::BRIGHT_RED, Colour::BRIGHT_GREEN, Colour::BRIGHT_YELLOW,
+                Colour::BRIGHT_BLUE, Colour::BRIGHT_MAGENTA, Colour::BRIGHT_CYAN, Colour::BRIGHT_WHITE
+            };
+            for (int i = 0; i < 256; i++) {
+                Rgb c = palette_rgb(static_cast<uint8_t>(i));
+                int best = 0, best_dist = 1 << 30;
+                for (int j = 0; j < 16; j++) {
+                    Rgb p = palette_rgb(static_cast<uint8_t>(j));
+                    int d = (p.r - c.r) * (p.r - c.r) + (p.g - c.g) * (p.g - c.g) + (p.b - c.b) * (p.b - c.b);
+                    if (d < best_dist) { best = j; best_dist = d; }
+                }
+                colour[i] = by_ansi[best];
+            }
+        }
+    };
+    static const Table table;
+    return table.colour[index];
+}
+
+// Closest Colour constant for any colour
+inline Colour to_basic(ColourSpec c) {
+    switch (c.kind()) {
+    case ColourSpec::PALETTE: return nearest_16(c.index());
+    case ColourSpec::RGB: return nearest_16(nearest_256(c.rgb()));
+    default: return c.basic();
+    }
+}
+
+// Append the SGR parameters selecting colour c ("38;..." for the foreground,
+// "48;..." for the background) at the given depth
+inline void append_sgr_colour(std::string& out, ColourSpec c, bool background, ColourDepth depth) {
+    char buf[24];
+    if (c.kind() == ColourSpec::RGB && depth == ColourDepth::TRUECOLOUR) {
+        Rgb rgb = c.rgb();
+        snprintf(buf, sizeof(buf), "%d;2;%d;%d;%d", background ? 48 : 38, rgb.r, rgb.g, rgb.b);
+    } else if (c.kind() != ColourSpec::BASIC && depth >= ColourDepth::COLOURS_256) {
+        int index = c.kind() == ColourSpec::RGB ? nearest_256(c.rgb()) : c.index();
+        snprintf(buf, sizeof(buf), "%d;5;%d", background ? 48 : 38, index);
+    } else {
+        int ansi = ansi_index(to_basic(c));
+        if (ansi >= 8 && depth == ColourDepth::COLOURS_8) ansi -= 8;
+        int base = ansi >= 8 ? (background ? 100 : 90) : (background ? 40 : 30);
+        snprintf(buf, sizeof(buf), "%d", base + ansi % 8);
+    }
+    out += buf;
+}
+
+// Global mutex for thread-safe console operations
+inline std::mutex& get_console_mutex() {
+    static std::mutex console_mutex;
+    return console_mutex;
+}
+
+#ifndef _WIN32
+// ncurses keeps a single "current" SCREEN per process, so every curses call
+// made on behalf of a Console has to hold this lock and select its screen first
+inline std::recursive_mutex& get_curses_mutex() {
+    static std::recursive_mutex curses_mutex;
+    return curses_mutex;
+}
+#endif
+
+// Decode one UTF-8 sequence and advance the pointer past it.
+// Malformed input yields U+FFFD and consumes a single byte.
+inline char32_t decode_utf8(const char*& p) {
+    const unsigned char* s = reinterpret_cast<const unsigned char*>(p);
+    char32_t cp;
+    int extra;
+    if (s[0] < 0x80) { p += 1; return s[0]; }
+    else if ((s[0] & 0xE0) == 0xC0) { cp = s[0] & 0x1F; extra = 1; }
+    else if ((s[0] & 0xF0) == 0xE0) { cp = s[0] & 0x0F; extra = 2; }
+    else if ((s[0] & 0xF8) == 0xF0) { cp = s[0] & 0x07; extra = 3; }
+    else { p += 1; return 0xFFFD; }
+
+    for (int i = 1; i <= extra; i++) {
+        if ((s[i] & 0xC0) != 0x80) { p += 1; return 0xFFFD; }
+        cp = (cp << 6) | (s[i] & 0x3F);
+    }
+    p += extra + 1;
+    return cp;
+}
+
+// True if cp lies in one of count sorted, non-overlapping [first, last] ranges
+inline bool in_ranges(char32_t cp, const char32_t (*ranges)[2], size_t count) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (cp < ranges[mid][0]) hi = mid;
+        else if (cp > ranges[mid][1]) lo = mid + 1;
+        else return true;
+    }
+    return false;
+}
+
+// Number of terminal columns a codepoint occupies (0, 1 or 2). Widths come
+// from a built-in table (Unicode 14 as glibc's wcwidth() reports it:
+// combining marks and format characters are zero width, East Asian wide and
+// fullwidth characters, including emoji, are double width) rather than
+// wcwidth() itself, so they do not depend on the locale: text measured
+// before setlocale() or outside a Console is laid out the same as text
+// drawn later.
+inline int char_width(char32_t cp) {
+    if (cp < 0x300) return 1;
+    static const char32_t zero[][2] = {
+        {0x300, 0x36F}, {0x483, 0x489}, {0x591, 0x5BD}, {0x5BF, 0x5BF}, {0x5C1, 0x5C2}, {0x5C4, 0x5C5},
+        {0x5C7, 0x5C7}, {0x610, 0x61A}, {0x61C, 0x61C}, {0x64B, 0x65F}, {0x670, 0x670}, {0x6D6, 0x6DC},
+        {0x6DF, 0x6E4}, {0x6E7, 0x6E8}, {0x6EA, 0x6ED}, {0x711, 0x711}, {0x730, 0x74A}, {0x7A6, 0x7B0},
+        {0x7EB, 0x7F3}, {0x7FD, 0x7FD}, {0x816, 0x819}, {0x81B, 0x823}, {0x825, 0x827}, {0x829, 0x82D},
+        {0x859, 0x85B}, {0x898, 0x89F}, {0x8CA, 0x8E1}, {0x8E3, 0x902}, {0x93A, 0x93A}, {0x93C, 0x93C},
+        {0x941, 0x948}, {0x94D, 0x94D}, {0x951, 0x957}, {0x962, 0x963}, {0x981, 0x981}, {0x9BC, 0x9BC},
+        {0x9C1, 0x9C4}, {0x9CD, 0x9CD}, {0x9E2, 0x9E3}, {0x9FE, 0xA02}, {0xA3C, 0xA3C}, {0xA41, 0xA51},
+        {0xA70, 0xA71}, {0xA75, 0xA75}, {0xA81, 0xA82}, {0xABC, 0xABC}, {0xAC1, 0xAC8}, {0xACD, 0xACD},
+        {0xAE2, 0xAE3}, {0xAFA, 0xB01}, {0xB3C, 0xB3C}, {0xB3F, 0xB3F}, {0xB41, 0xB44}, {0xB4D, 0xB56},
+        {0xB62, 0xB63}, {0xB82, 0xB82}, {0xBC0, 0xBC0}, {0xBCD, 0xBCD}, {0xC00, 0xC00}, {0xC04, 0xC04},
+        {0xC3C, 0xC3C}, {0xC3E, 0xC40}, {0xC46, 0xC56}, {0xC62, 0xC63}, {0xC81, 0xC81}, {0xCBC, 0xCBC},
+        {0xCBF, 0xCBF}, {0xCC6, 0xCC6}, {0xCCC, 0xCCD}, {0xCE2, 0xCE3}, {0xD00, 0xD01}, {0xD3B, 0xD3C},
+        {0xD41, 0xD44}, {0xD4D, 0xD4D}, {0xD62, 0xD63}, {0xD81, 0xD81}, {0xDCA, 0xDCA}, {0xDD2, 0xDD6},
+        {0xE31, 0xE31}, {0xE34, 0xE3A}, {0xE47, 0xE4E}, {0xEB1, 0xEB1}, {0xEB4, 0xEBC}, {0xEC8, 0xECD},
+        {0xF18, 0xF19}, {0xF35, 0xF35}, {0xF37, 0xF37}, {0xF39, 0xF39}, {0xF71, 0xF7E}, {0xF80, 0xF84},
+        {0xF86, 0xF87}, {0xF8D, 0xFBC}, {0xFC6, 0xFC6}, {0x102D, 0x1030}, {0x1032, 0x1037},
+        {0x1039, 0x103A}, {0x103D, 0x103E}, {0x1058, 0x1059}, {0x105E, 0x1060}, {0x1071, 0x1074},
+        {0x1082, 0x1082}, {0x1085, 0x1086}, {0x108D, 0x108D}, {0x109D, 0x109D}, {0x1160, 0x11FF},
+        {0x135D, 0x135F}, {0x1712, 0x1714}, {0x1732, 0x1733}, {0x1752, 0x1753}, {0x1772, 0x1773},
+        {0x17B4, 0x17B5}, {0x17B7, 0x17BD}, {0x17C6, 0x17C6}, {0x17C9, 0x17D3}, {0x17DD, 0x17DD},
+        {0x180B, 0x180F}, {0x1885, 0x1886}, {0x18A9, 0x18A9}, {0x1920, 0x1922}, {0x1927, 0x1928},
+        {0x1932, 0x1932}, {0x1939, 0x193B}, {0x1A17, 0x1A18}, {0x1A1B, 0x1A1B}, {0x1A56, 0x1A56},
+        {0x1A58, 0x1A60}, {0x1A62, 0x1A62}, {0x1A65, 0x1A6C}, {0x1A73, 0x1A7F}, {0x1AB0, 0x1B03},
+        {0x1B34, 0x1B34}, {0x1B36, 0x1B3A}, {0x1B3C, 0x1B3C}, {0x1B42, 0x1B42}, {0x1B6B, 0x1B73},
+        {0x1B80, 0x1B81}, {0x1BA2, 0x1BA5}, {0x1BA8, 0x1BA9}, {0x1BAB, 0x1BAD}, {0x1BE6, 0x1BE6},
+        {0x1BE8, 0x1BE9}, {0x1BED, 0x1BED}, {0x1BEF, 0x1BF1}, {0x1C2C, 0x1C33}, {0x1C36, 0x1C37},
+        {0x1CD0, 0x1CD2}, {0x1CD4, 0x1CE0}, {0x1CE2, 0x1CE8}, {0x1CED, 0x1CED}, {0x1CF4, 0x1CF4},
+        {0x1CF8, 0x1CF9}, {0x1DC0, 0x1DFF}, {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x206F},
+        {0x20D0, 0x20F0}, {0x2CEF, 0x2CF1}, {0x2D7F, 0x2D7F}, {0x2DE0, 0x2DFF}, {0x302A, 0x302D},
+        {0x3099, 0x309A}, {0xA66F, 0xA672}, {0xA674, 0xA67D}, {0xA69E, 0xA69F}, {0xA6F0, 0xA6F1},
+        {0xA802, 0xA802}, {0xA806, 0xA806}, {0xA80B, 0xA80B}, {0xA825, 0xA826}, {0xA82C, 0xA82C},
+        {0xA8C4, 0xA8C5}, {0xA8E0, 0xA8F1}, {0xA8FF, 0xA8FF}, {0xA926, 0xA92D}, {0xA947, 0xA951},
+        {0xA980, 0xA982}, {0xA9B3, 0xA9B3}, {0xA9B6, 0xA9B9}, {0xA9BC, 0xA9BD}, {0xA9E5, 0xA9E5},
+        {0xAA29, 0xAA2E}, {0xAA31, 0xAA32}, {0xAA35, 0xAA36}, {0xAA43, 0xAA43}, {0xAA4C, 0xAA4C},
+        {0xAA7C, 0xAA7C}, {0xAAB0, 0xAAB0}, {0xAAB2, 0xAAB4}, {0xAAB7, 0xAAB8}, {0xAABE, 0xAABF},
+        {0xAAC1, 0xAAC1}, {0xAAEC, 0xAAED}, {0xAAF6, 0xAAF6}, {0xABE5, 0xABE5}, {0xABE8, 0xABE8},
+        {0xABED, 0xABED}, {0xD7B0, 0xD7FB}, {0xFB1E, 0xFB1E}, {0xFE00, 0xFE0F}, {0xFE20, 0xFE2F},
+        {0xFEFF, 0xFEFF}, {0xFFF9, 0xFFFB}, {0x101FD, 0x101FD}, {0x102E0, 0x102E0}, {0x10376, 0x1037A},
+        {0x10A01, 0x10A0F}, {0x10A38, 0x10A3F}, {0x10AE5, 0x10AE6}, {0x10D24, 0x10D27},
+        {0x10EAB, 0x10EAC}, {0x10F46, 0x10F50}, {0x10F82, 0x10F85}, {0x11001, 0x11001},
+        {0x11038, 0x11046}, {0x11070, 0x11070}, {0x11073, 0x11074}, {0x1107F, 0x11081},
+        {0x110B3, 0x110B6}, {0x110B9, 0x110BA}, {0x110C2, 0x110C2}, {0x11100, 0x11102},
+        {0x11127, 0x1112B}, {0x1112D, 0x11134}, {0x11173, 0x11173}, {0x11180, 0x11181},
+        {0x111B6, 0x111BE}, {0x111C9, 0x111CC}, {0x111CF, 0x111CF}, {0x1122F, 0x11231},
+        {0x11234, 0x11234}, {0x11236, 0x11237}, {0x1123E, 0x1123E}, {0x112DF, 0x112DF},
+        {0x112E3, 0x112EA}, {0x11300, 0x11301}, {0x1133B, 0x1133C}, {0x11340, 0x11340},
+        {0x11366, 0x11374}, {0x11438, 0x1143F}, {0x11442, 0x11444}, {0x11446, 0x11446},
+        {0x1145E, 0x1145E}, {0x114B3, 0x114B8}, {0x114BA, 0x114BA}, {0x114BF, 0x114C0},
+        {0x114C2, 0x114C3}, {0x115B2, 0x115B5}, {0x115BC, 0x115BD}, {0x115BF, 0x115C0},
+        {0x115DC, 0x115DD}, {0x11633, 0x1163A}, {0x1163D, 0x1163D}, {0x1163F, 0x11640},
+        {0x116AB, 0x116AB}, {0x116AD, 0x116AD}, {0x116B0, 0x116B5}, {0x116B7, 0x116B7},
+        {0x1171D, 0x1171F}, {0x11722, 0x11725}, {0x11727, 0x1172B}, {0x1182F, 0x11837},
+        {0x11839, 0x1183A}, {0x1193B, 0x1193C}, {0x1193E, 0x1193E}, {0x11943, 0x11943},
+        {0x119D4, 0x119DB}, {0x119E0, 0x119E0}, {0x11A01, 0x11A0A}, {0x11A33, 0x11A38},
+        {0x11A3B, 0x11A3E}, {0x11A47, 0x11A47}, {0x11A51, 0x11A56}, {0x11A59, 0x11A5B},
+        {0x11A8A, 0x11A96}, {0x11A98, 0x11A99}, {0x11C30, 0x11C3D}, {0x11C3F, 0x11C3F},
+        {0x11C92, 0x11CA7}, {0x11CAA, 0x11CB0}, {0x11CB2, 0x11CB3}, {0x11CB5, 0x11CB6},
+        {0x11D31, 0x11D45}, {0x11D47, 0x11D47}, {0x11D90, 0x11D91}, {0x11D95, 0x11D95},
+        {0x11D97, 0x11D97}, {0x11EF3, 0x11EF4}, {0x13430, 0x13438}, {0x16AF0, 0x16AF4},
+        {0x16B30, 0x16B36}, {0x16F4F, 0x16F4F}, {0x16F8F, 0x16F92}, {0x16FE4, 0x16FE4},
+        {0x1BC9D, 0x1BC9E}, {0x1BCA0, 0x1CF46}, {0x1D167, 0x1D169}, {0x1D173, 0x1D182},
+        {0x1D185, 0x1D18B}, {0x1D1AA, 0x1D1AD}, {0x1D242, 0x1D244}, {0x1DA00, 0x1DA36},
+        {0x1DA3B, 0x1DA6C}, {0x1DA75, 0x1DA75}, {0x1DA84, 0x1DA84}, {0x1DA9B, 0x1DAAF},
+        {0x1E000, 0x1E02A}, {0x1E130, 0x1E136}, {0x1E2AE, 0x1E2AE}, {0x1E2EC, 0x1E2EF},
+        {0x1E8D0, 0x1E8D6}, {0x1E944, 0x1E94A}, {0xE0001, 0xE01EF}
+    };
+    static const char32_t wide[][2] = {
+        {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0},
+        {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F},
+        {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5},
+        {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5},
+        {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728},
+        {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797},
+        {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55},
+        {0x2E80, 0x3029}, {0x302E, 0x303E}, {0x3041, 0x3096}, {0x309B, 0xA4C6}, {0xA960, 0xA97C},
+        {0xAC00, 0xD7A3}, {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6B}, {0xFF01, 0xFF60},
+        {0xFFE0, 0xFFE6}, {0x16FE0, 0x16FE3}, {0x16FF0, 0x1B2FB}, {0x1F004, 0x1F004},
+        {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F320},
+        {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C}, {0x1F37E, 0x1F393}, {0x1F3A0, 0x1F3CA},
+        {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4}, {0x1F3F8, 0x1F43E},
+        {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D}, {0x1F54B, 0x1F54E},
+        {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A}, {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4},
+        {0x1F5FB, 0x1F64F}, {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2},
+        {0x1F6D5, 0x1F6DF}, {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7F0},
+        {0x1F90C, 0x1F93A}, {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF}, {0x1FA70, 0x1FAF6},
+        {0x20000, 0x3FFFD}
+    };
+    if (in_ranges(cp, zero, sizeof(zero) / sizeof(zero[0]))) return 0;
+    if (cp >= 0x1100 && in_ranges(cp, wide, sizeof(wide) / sizeof(wide[0]))) return 2;
+    return 1;
+}
+
+// Index of the lowest / highest set bit of a non-zero mask
+inline int lowest_bit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+inline int highest_bit(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse(&index, mask);
+    return static_cast<int>(index);
+#else
+    return 31 - __builtin_clz(mask);
+#endif
+}
+
+// Byte offset of the first difference between two buffers, or n if equal
+inline size_t first_difference(const void* a, const void* b, size_t n) {
+    const unsigned char* pa = static_cast<const unsigned char*>(a);
+    const unsigned char* pb = static_cast<const unsigned char*>(b);
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pa + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pb + i));
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+        if (mask) return i + lowest_bit(mask);
+    }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + i));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb))) ^ 0xFFFFu;
+        if (mask) return i + lowest_bit(mask);
+    }
+#endif
+    for (; i < n; i++) {
+        if (pa[i] != pb[i]) return i;
+    }
+    return n;
+}
+
+// Byte offset of the last difference between two buffers, or n if equal
+inline size_t last_difference(const void* a, const void* b, size_t n) {
+    const unsigned char* pa = static_cast<const unsigned char*>(a);
+    const unsigned char* pb = static_cast<const unsigned char*>(b);
+    size_t i = n;
+#if defined(__AVX2__)
+    for (; i >= 32; i -= 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pa + i - 32));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pb + i - 32));
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb)));
+        if (mask) return i - 32 + highest_bit(mask);
+    }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    for (; i >= 16; i -= 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + i - 16));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + i - 16));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb))) ^ 0xFFFFu;
+        if (mask) return i - 16 + highest_bit(mask);
+    }
+#endif
+    while (i > 0) {
+        i--;
+        if (pa[i] != pb[i]) return i;
+    }
+    return n;
+}
+
+// 64-bit hash of a byte span, used to detect unchanged rows
+inline uint64_t hash_bytes(const void* data, size_t n) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = 0x9E3779B97F4A7C15ULL ^ n;
+    for (; n >= 8; p += 8, n -= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        h = (h ^ v) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    if (n) {
+        uint64_t v = 0;
+        memcpy(&v, p, n);
+        h = (h ^ v) * 0xFF51AFD7ED558CCDULL;
+    }
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// Append the UTF-8 encoding of a codepoint to a string
+inline void encode_utf8(char32_t cp, std::string& out) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+// Text attribute flags for Canvas::textstyle()
+enum Attribute : uint8_t {
+    ATTR_NONE = 0,
+    ATTR_BOLD = 1,
+    ATTR_UNDERLINE = 2,
+    ATTR_REVERSE = 4
+};
+
+// Colours and attributes shared by many cells
+struct Style {
+    ColourSpec fg;
+    ColourSpec bg;
+    uint8_t attrs;
+
+    bool operator==(const Style& other) const {
+        return fg == other.fg && bg == other.bg && attrs == other.attrs;
+    }
+};
+
+struct StyleHash {
+    size_t operator()(const Style& s) const {
+        uint64_t key = (static_cast<uint64_t>(s.fg.raw()) << 32) ^ (static_cast<uint64_t>(s.bg.raw()) << 5) ^ s.attrs;
+        return static_cast<size_t>(key ^ (key >> 29));
+    }
+};
+
+// Append the escape sequence selecting a style to out. With
+// terminal_defaults, white text and a black background are left as the
+// terminal's own default colours.
+inline void append_sgr(std::string& out, const Style& style, ColourDepth depth, bool terminal_defaults = false) {
+    out += "\x1b[0";
+    if (style.attrs & ATTR_BOLD) out += ";1";
+    if (style.attrs & ATTR_UNDERLINE) out += ";4";
+    if (style.attrs & ATTR_REVERSE) out += ";7";
+    if (!terminal_defaults || style.fg != ColourSpec(Colour::WHITE)) {
+        out += ';';
+        append_sgr_colour(out, style.fg, false, depth);
+    }
+    if (!terminal_defaults || style.bg != ColourSpec(Colour::BLACK)) {
+        out += ';';
+        append_sgr_colour(out, style.bg, true, depth);
+    }
+    out += 'm';
+}
+
+// Heap bytes owned by a table entry, for memory reporting
+inline size_t heap_bytes(const Style&) { return 0; }
+inline size_t heap_bytes(const std::string& s) { return s.capacity() > 15 ? s.capacity() + 1 : 0; }
+
+// Table handing out a stable index for each distinct value.
+// Entries live in fixed-size chunks and never move, so an index obtained
+// from intern() can be looked up from any thread without locking.
+// Entries stay until reclaim() frees those no longer referenced; freed
+// indices are handed out again. Once the table is full intern() returns FULL
+// for new values and counts them in overflows(), and the caller falls back
+// to something it can represent. The last reserve entries are kept for
+// callers that pass use_reserve, so a bounded set of fallback values always
+// fits.
+template <typename T, typename Hash>
+class InternTable {
+private:
+    static const uint32_t CHUNK_SIZE = 1024;
+    static const uint32_t MAX_CHUNKS = 1024;
+
+    mutable std::mutex mutex;
+    std::unordered_map<T, uint32_t, Hash> index;
+    std::unique_ptr<T[]> chunks[MAX_CHUNKS];
+    uint32_t count;                // indices handed out so far, including freed ones
+    std::vector<uint32_t> free_ids; // freed indices, reused before new ones
+    uint32_t reserve;
+    uint64_t overflow_count;
+    size_t entry_heap;
+
+public:
+    static const uint32_t FULL = 0xFFFFFFFF;
+
+    explicit InternTable(const T& first, uint32_t reserve = 0)
+        : count(0), reserve(reserve), overflow_count(0), entry_heap(0) { intern(first); }
+
+    // Index of value, adding it if new, or FULL if there is no room for it
+    uint32_t intern(const T& value, bool use_reserve = false) {
+        std::lock_guard<std::mutex> lock(mutex);
+        typename std::unordered_map<T, uint32_t, Hash>::const_iterator it = index.find(value);
+        if (it != index.end()) return it->second;
+        uint32_t used = count - static_cast<uint32_t>(free_ids.size());
+        if (used >= CHUNK_SIZE * MAX_CHUNKS - (use_reserve ? 0 : reserve)) {
+            overflow_count++;
+            return FULL;
+        }
+
+        uint32_t id;
+        if (!free_ids.empty()) {
+            id = free_ids.back();
+            free_ids.pop_back();
+        } else {
+            id = count++;
+            if (id % CHUNK_SIZE == 0) chunks[id / CHUNK_SIZE].reset(new T[CHUNK_SIZE]);
+        }
+        chunks[id / CHUNK_SIZE][id % CHUNK_SIZE] = value;
+        index.insert(std::make_pair(value, id));
+        entry_heap += 2 * heap_bytes(value); // one copy in the chunk, one in the index
+        return id;
+    }
+
+    // Free every entry except entry 0 whose index is not marked in live.
+    // Nothing may look up or hand out a freed index afterwards, so the
+    // caller must know every index still held. Returns the entries freed.
+    size_t reclaim(const std::vector<unsigned char>& live) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t freed = 0;
+        typename std::unordered_map<T, uint32_t, Hash>::iterator it = index.begin();
+        while (it != index.end()) {
+            uint32_t id = it->second;
+            if (id == 0 || (id < live.size() && live[id])) {
+                ++it;
+                continue;
+            }
+            size_t bytes = 2 * heap_bytes(it->first);
+            entry_heap -= std::min(entry_heap, bytes);
+            T empty = T();
+            std::swap(chunks[id / CHUNK_SIZE][id % CHUNK_SIZE], empty); // releases the value's memory
+            free_ids.push_back(id);
+            it = index.erase(it);
+            freed++;
+        }
+        return freed;
+    }
+
+    const T& operator[](uint32_t id) const { return chunks[id / CHUNK_SIZE][id % CHUNK_SIZE]; }
+
+    // Entries in use
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count - free_ids.size();
+    }
+
+    // One past the highest index handed out so far
+    uint32_t extent() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return count;
+    }
+
+    // Values turned away because the table was full
+    uint64_t overflows() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return overflow_count;
+    }
+
+    // Approximate bytes held by the table
+    size_t memory_usage() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t used_chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        return sizeof(*this) + used_chunks * CHUNK_SIZE * sizeof(T) +
+               index.bucket_count() * sizeof(void*) +
+               index.size() * (sizeof(T) + sizeof(uint32_t) + 2 * sizeof(void*)) +
+               free_ids.capacity() * sizeof(uint32_t) + entry_heap;
+    }
+};
+
+// Process-wide style table; index 0 is white on black with no attributes.
+// Room is kept for every combination of the 16 basic colours and the
+// attribute flags, which is what styles degrade to once the table is full.
+inline InternTable<Style, StyleHash>& style_table() {
+    static InternTable<Style, StyleHash> table(Style{Colour::WHITE, Colour::BLACK, ATTR_NONE}, 16 * 16 * 8);
+    return table;
+}
+
+// Counts calls to reclaim_shared_tables(). Anything that keeps style or
+// grapheme indices outside a Canvas or PreparedText, such as a cache or the
+// row hashes of a frame no longer held, must drop them when this changes.
+inline std::atomic<uint32_t>& shared_table_generation() {
+    static std::atomic<uint32_t> generation(0);
+    return generation;
+}
+
+// Index of a style in style_table(). Recent lookups are kept in a small
+// per-thread cache, so threads switching between the same few colours do
+// not contend for the table lock. If the table is full, palette and RGB
+// colours are drawn as the nearest basic colours instead.
+inline uint32_t intern_style(const Style& style) {
+    struct Entry {
+        uint32_t fg;
+        uint32_t bg;
+        uint8_t attrs;
+        uint32_t generation;
+        uint32_t id_plus_one; // 0 while the entry is unused
+    };
+    static const size_t CACHE_SIZE = 64;
+    static thread_local Entry cache[CACHE_SIZE];
+
+    uint32_t generation = shared_table_generation().load(std::memory_order_relaxed);
+    Entry& entry = cache[StyleHash()(style) % CACHE_SIZE];
+    if (entry.id_plus_one != 0 && entry.generation == generation && entry.fg == style.fg.raw() &&
+        entry.bg == style.bg.raw() && entry.attrs == style.attrs) {
+        return entry.id_plus_one - 1;
+    }
+    uint32_t id = style_table().intern(style);
+    if (id == InternTable<Style, StyleHash>::FULL) {
+        uint8_t attrs = style.attrs & (ATTR_BOLD | ATTR_UNDERLINE | ATTR_REVERSE);
+        id = style_table().intern(Style{to_basic(style.fg), to_basic(style.bg), attrs}, true);
+    }
+    entry.fg = style.fg.raw();
+    entry.bg = style.bg.raw();
+    entry.attrs = style.attrs;
+    entry.generation = generation;
+    entry.id_plus_one = id + 1;
+    return id;
+}
+
+// Process-wide side arena for grapheme clusters that need more than one
+// codepoint, such as ZWJ emoji sequences and base letters with combining marks
+inline InternTable<std::string, std::hash<std::string> >& grapheme_table() {
+    static InternTable<std::string, std::hash<std::string> > table(std::string(" "));
+    return table;
+}
+
+// Bytes held by the shared style and grapheme tables
+inline size_t shared_memory_usage() {
+    return style_table().memory_usage() + grapheme_table().memory_usage();
+}
+
+// Styles and grapheme clusters that did not fit in the shared tables and
+// were drawn approximately (basic colours, or the cluster's first codepoint)
+inline uint64_t shared_table_overflows() {
+    return style_table().overflows() + grapheme_table().overflows();
+}
+
+// One character cell of a screen model, packed into 8 bytes.
+// glyph holds a 21-bit codepoint, or EXTENDED plus a grapheme_table() index
+// for multi-codepoint clusters; style indexes style_table(). Both tables are
+// shared by all canvases, so cells compare correctly across canvases.
+// A double-width glyph lives in the left cell; the cell to its right holds
+// glyph == 0 and is never drawn on its own.
+struct Cell {
+    static const uint32_t EXTENDED = 0x80000000u;
+
+    uint32_t glyph;
+    uint32_t style;
+
+    bool operator==(const Cell& other) const {
+        return glyph == other.glyph && style == other.style;
+    }
+    bool operator!=(const Cell& other) const { return !(*this == other); }
+};
+
+// Rows are diffed and hashed as raw bytes, which needs a padding-free cell
+static_assert(sizeof(Cell) == 8, "Cell must be 8 bytes with no padding");
+
+// UTF-8 text of a cell's glyph
+inline std::string glyph_text(uint32_t glyph) {
+    if (glyph & Cell::EXTENDED) return grapheme_table()[glyph & ~Cell::EXTENDED];
+    std::string text;
+    encode_utf8(glyph, text);
+    return text;
+}
+
+// First codepoint of a cell's glyph
+inline char32_t glyph_base(uint32_t glyph) {
+    if (!(glyph & Cell::EXTENDED)) return glyph;
+    const char* p = grapheme_table()[glyph & ~Cell::EXTENDED].c_str();
+    return decode_utf8(p);
+}
+
+// True if cp continues the grapheme cluster before it rather than starting a
+// new cell: combining marks, variation selectors, ZWJ and emoji modifiers
+inline bool extends_cluster(char32_t cp) {
+    return cp == 0x200D || (cp >= 0x1F3FB && cp <= 0x1F3FF) || char_width(cp) == 0;
+}
+
+// Append the escape sequences drawing cells first..last of a row, switching
+// style only where it changes. Right halves of wide glyphs are skipped.
+// With terminal_defaults, white on black is left in the terminal's own
+// default colours, as for append_sgr().
+inline void append_cells(std::string& out, const Cell* cells, int first, int last, ColourDepth depth,
+                         bool terminal_defaults = false) {
+    uint32_t current = 0xFFFFFFFFu;
+    for (int x = first; x <= last; x++) {
+        uint32_t glyph = cells[x].glyph;
+        if (glyph == 0) continue;
+        if (cells[x].style != current) {
+            current = cells[x].style;
+            append_sgr(out, style_table()[current], depth, terminal_defaults);
+        }
+        if (glyph & Cell::EXTENDED) out += grapheme_table()[glyph & ~Cell::EXTENDED];
+        else encode_utf8(glyph, out);
+    }
+}
+
+// Style and grapheme indices found in use, indexed like the tables
+struct SharedTableMarks {
+    std::vector<unsigned char> styles;
+    std::vector<unsigned char> glyphs;
+
+    void mark(const Cell& cell) {
+        if (cell.style < styles.size()) styles[cell.style] = 1;
+        if (cell.glyph & Cell::EXTENDED) {
+            uint32_t id = cell.glyph & ~Cell::EXTENDED;
+            if (id < glyphs.size()) glyphs[id] = 1;
+        }
+    }
+};
+
+// Base of the classes that keep cells (Canvas and PreparedText). Every
+// instance is linked into a process-wide list so reclaim_shared_tables()
+// can find the table indices still in use.
+class CellHolder {
+private:
+    CellHolder* prev;
+    CellHolder* next;
+
+    static std::mutex& list_mutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+    static CellHolder*& head() {
+        static CellHolder* first = nullptr;
+        return first;
+    }
+
+    void link() {
+        std::lock_guard<std::mutex> lock(list_mutex());
+        prev = nullptr;
+        next = head();
+        if (next) next->prev = this;
+        head() = this;
+    }
+
+    void unlink() {
+        std::lock_guard<std::mutex> lock(list_mutex());
+        if (prev) prev->next = next;
+        else head() = next;
+        if (next) next->prev = prev;
+    }
+
+protected:
+    CellHolder() { link(); }
+    CellHolder(const CellHolder&) { link(); }
+    CellHolder& operator=(const CellHolder&) { return *this; }
+    ~CellHolder() { unlink(); }
+
+public:
+    // Mark every style and grapheme index this object holds
+    virtual void mark_shared(SharedTableMarks& marks) const = 0;
+
+    // Call f on every live holder
+    template <typename F>
+    static void for_each(F f) {
+        std::lock_guard<std::mutex> lock(list_mutex());
+        for (const CellHolder* holder = head(); holder; holder = holder->next) f(*holder);
+    }
+};
+
+// Free the style and grapheme table entries that no Canvas or PreparedText
+// uses any more, so a long-running program that keeps producing new RGB
+// colours or clusters does not fill the tables. No other thread may draw,
+// present or create canvases while this runs; call it from the presenting
+// thread between frames, e.g. every few thousand frames. Returns the number
+// of entries freed.
+inline size_t reclaim_shared_tables() {
+    SharedTableMarks marks;
+    marks.styles.assign(style_table().extent(), 0);
+    marks.glyphs.assign(grapheme_table().extent(), 0);
+    CellHolder::for_each([&marks](const CellHolder& holder) { holder.mark_shared(marks); });
+    size_t freed = style_table().reclaim(marks.styles) + grapheme_table().reclaim(marks.glyphs);
+    shared_table_generation()++;
+    return freed;
+}
+
+class PreparedText;
+class PreparedBox;
+
+// Off-screen screen model with the same drawing API as the console.
+// Build a frame once, then present it to any number of consoles; each
+// console only sends the cells that differ from what it last displayed.
+class Canvas : public CellHolder {
+private:
+    int width_;
+    int height_;
+    std::vector<Cell> cells;
+    int cur_x;
+    int cur_y;
+    ColourSpec fg;
+    ColourSpec bg;
+    uint8_t attrs;
+    uint32_t style;  // style_table() index of fg/bg/attrs
+    int last_x;      // cell holding the last glyph drawn, or -1
+    int last_y;
+    bool join_next;  // previous codepoint was a ZWJ
+    // Per-row hash of the cells, recomputed lazily for rows marked dirty
+    mutable std::vector<uint64_t> hashes;
+    mutable std::vector<unsigned char> dirty;
+
+    void update_style() {
+        style = intern_style(Style{fg, bg, attrs});
+    }
+
+    // Append cp to the grapheme cluster of the previous glyph
+    void extend_previous(char32_t cp) {
+        if (last_x < 0) return;
+        Cell& cell = cells[last_y * width_ + last_x];
+        std::string cluster = glyph_text(cell.glyph);
+        encode_utf8(cp, cluster);
+        uint32_t id = grapheme_table().intern(cluster);
+        if (id != InternTable<std::string, std::hash<std::string> >::FULL) cell.glyph = Cell::EXTENDED | id;
+        dirty[last_y] = 1;
+        join_next = (cp == 0x200D);
+    }
+
+    void put_cell(char32_t cp) {
+        if (cp < 0x20) {
+            // Control characters move the cursor rather than fill a cell
+            if (cp == '\n') { cur_x = 0; cur_y++; }
+            else if (cp == '\r') cur_x = 0;
+            join_next = false;
+            last_x = -1;
+            return;
+        }
+        if (join_next || extends_cluster(cp)) {
+            extend_previous(cp);
+            return;
+        }
+        int w = char_width(cp);
+        last_x = -1;
+        if (cur_y < 0 || cur_y >= height_ || cur_x < 0 || cur_x + w > width_) {
+            cur_x += w;
+            return;
+        }
+        dirty[cur_y] = 1;
+        Cell* row = &cells[cur_y * width_];
+        // Overwriting either half of a wide glyph blanks the other half
+        if (row[cur_x].glyph == 0 && cur_x > 0) row[cur_x - 1].glyph = ' ';
+        if (cur_x + w < width_ && row[cur_x + w].glyph == 0) row[cur_x + w].glyph = ' ';
+        row[cur_x].glyph = cp & 0x1FFFFF;
+        row[cur_x].style = style;
+        if (w == 2) {
+            row[cur_x + 1].glyph = 0;
+            row[cur_x + 1].style = style;
+        }
+        last_x = cur_x;
+        last_y = cur_y;
+        cur_x += w;
+    }
+
+public:
+    Canvas(int width, int height)
+        : width_(0), height_(0), cur_x(0), cur_y(0),
+          fg(Colour::WHITE), bg(Colour::BLACK), attrs(ATTR_NONE), style(0),
+          last_x(-1), last_y(0), join_next(false) {
+        resize(width, height);
+    }
+
+    int getwidth() const { return width_; }
+    int getheight() const { return height_; }
+
+    void mark_shared(SharedTableMarks& marks) const override {
+        for (size_t i = 0; i < cells.size(); i++) marks.mark(cells[i]);
+        if (style < marks.styles.size()) marks.styles[style] = 1;
+    }
+
+    // Resize the canvas; the contents are cleared
+    void resize(int width, int height) {
+        width_ = width > 0 ? width : 0;
+        height_ = height > 0 ? height : 0;
+        cells.assign(static_cast<size_t>(width_) * height_, Cell{' ', 0});
+        hashes.assign(height_, 0);
+        dirty.assign(height_, 1);
+        cur_x = cur_y = 0;
+        last_x = -1;
+    }
+
+    Cell& at(int x, int y) { dirty[y] = 1; return cells[y * width_ + x]; }
+    const Cell& at(int x, int y) const { return cells[y * width_ + x]; }
+
+    Cell* row(int y) { dirty[y] = 1; return &cells[y * width_]; }
+    const Cell* row(int y) const { return &cells[y * width_]; }
+
+    // Hash of row y; rows that have not changed since the last call are O(1)
+    uint64_t row_hash(int y) const {
+        if (dirty[y]) {
+            hashes[y] = hash_bytes(&cells[y * width_], width_ * sizeof(Cell));
+            dirty[y] = 0;
+        }
+        return hashes[y];
+    }
+
+    // Bring all row hashes up to date. present() does this lazily; call it
+    // first when presenting one canvas from several threads at once.
+    void hash_rows() const {
+        for (int y = 0; y < height_; y++) row_hash(y);
+    }
+
+    // Copy a run of cells into row y starting at column x, clipped to the canvas
+    void put_cells(int x, int y, const Cell* src, int count) {
+        if (y < 0 || y >= height_) return;
+        int s0 = x < 0 ? -x : 0;
+        int s1 = std::min(count, width_ - x);
+        if (s0 >= s1) return;
+
+        dirty[y] = 1;
+        Cell* row = &cells[y * width_];
+        int dx0 = x + s0;
+        int dx1 = x + s1;
+        // Don't leave half of a wide glyph behind at either edge
+        if (dx0 > 0 && row[dx0].glyph == 0) row[dx0 - 1].glyph = ' ';
+        if (dx1 < width_ && row[dx1].glyph == 0) row[dx1].glyph = ' ';
+        std::copy(src + s0, src + s1, row + dx0);
+        if (row[dx0].glyph == 0) row[dx0].glyph = ' ';
+        if (s1 < count && src[s1].glyph == 0) row[dx1 - 1].glyph = ' ';
+        last_x = -1;
+    }
+
+    // Copy another canvas onto this one with its top-left corner at (x, y)
+    void blit(const Canvas& src, int x, int y) {
+        if (src.width_ == 0) return;
+        for (int sy = 0; sy < src.height_; sy++) put_cells(x, y + sy, src.row(sy), src.width_);
+    }
+
+    // Draw prepared text or a prepared box by copying its cells
+    void draw(int x, int y, const PreparedText& text);
+    void draw(int x, int y, const PreparedBox& box);
+
+    // Bytes used by this canvas's cells and row hashes. Styles and extended
+    // graphemes live in shared tables, see shared_memory_usage().
+    size_t memory_usage() const {
+        return sizeof(*this) + cells.capacity() * sizeof(Cell) +
+               hashes.capacity() * sizeof(uint64_t) + dirty.capacity();
+    }
+
+    // Clear to the current background colour and home the cursor
+    void clrscr() {
+        Cell blank = {' ', style};
+        std::fill(cells.begin(), cells.end(), blank);
+        std::fill(dirty.begin(), dirty.end(), 1);
+        cur_x = cur_y = 0;
+        last_x = -1;
+    }
+
+    void gotoxy(int x, int y) { cur_x = x; cur_y = y; last_x = -1; join_next = false; }
+    int wherex() const { return cur_x; }
+    int wherey() const { return cur_y; }
+    void textcolour(ColourSpec c) { fg = c; update_style(); }
+    void textbackground(ColourSpec c) { bg = c; update_style(); }
+    void textattr(ColourSpec f, ColourSpec b) { fg = f; bg = b; update_style(); }
+    // Set text attributes, a combination of ATTR_BOLD, ATTR_UNDERLINE and ATTR_REVERSE
+    void textstyle(uint8_t a) { attrs = a; update_style(); }
+    void resetattr() { fg = Colour::WHITE; bg = Colour::BLACK; attrs = ATTR_NONE; style = 0; }
+
+    void putch(char c) { put_cell(static_cast<unsigned char>(c)); }
+    void putch(int x, int y, char c) { gotoxy(x, y); putch(c); }
+    void putch(int x, int y, char c, ColourSpec f) { gotoxy(x, y); textcolour(f); putch(c); }
+    void putch(int x, int y, char c, ColourSpec f, ColourSpec b) { gotoxy(x, y); textattr(f, b); putch(c); }
+
+    void putwch(wchar_t wc) { put_cell(static_cast<char32_t>(wc)); }
+    void putwch(int x, int y, wchar_t wc) { gotoxy(x, y); putwch(wc); }
+    void putwch(int x, int y, wchar_t wc, ColourSpec f) { gotoxy(x, y); textcolour(f); putwch(wc); }
+    void putwch(int x, int y, wchar_t wc, ColourSpec f, ColourSpec b) { gotoxy(x, y); textattr(f, b); putwch(wc); }
+
+    // Goes through print_utf8 so each cluster is interned whole
+    void wputs(const wchar_t* wstr) {
+        std::string utf8;
+        while (*wstr) {
+            char32_t cp = static_cast<char32_t>(*wstr++);
+            if (cp >= 0xD800 && cp < 0xDC00 && *wstr >= 0xDC00 && *wstr < 0xE000) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (static_cast<char32_t>(*wstr++) - 0xDC00);
+            }
+            encode_utf8(cp, utf8);
+        }
+        print_utf8(utf8.c_str());
+    }
+    void wputs(int x, int y, const wchar_t* wstr) { gotoxy(x, y); wputs(wstr); }
+    void wputs(int x, int y, ColourSpec f, const wchar_t* wstr) { gotoxy(x, y); textcolour(f); wputs(wstr); }
+    void wputs(int x, int y, ColourSpec f, ColourSpec b, const wchar_t* wstr) { gotoxy(x, y); textattr(f, b); wputs(wstr); }
+
+    void print_utf8(const char* utf8_str) {
+        while (*utf8_str) {
+            const char* start = utf8_str;
+            char32_t cp = decode_utf8(utf8_str);
+            if (join_next || extends_cluster(cp)) {
+                extend_previous(cp);
+                continue;
+            }
+            // Gather the whole cluster so only the complete sequence is interned
+            const char* end = utf8_str;
+            bool joined = false;
+            while (*end) {
+                const char* p = end;
+                char32_t next = decode_utf8(p);
+                if (!joined && !extends_cluster(next)) break;
+                joined = (next == 0x200D);
+                end = p;
+            }
+            put_cell(cp);
+            if (end != utf8_str && last_x >= 0) {
+                uint32_t id = grapheme_table().intern(std::string(start, end));
+                if (id != InternTable<std::string, std::hash<std::string> >::FULL) {
+                    cells[last_y * width_ + last_x].glyph = Cell::EXTENDED | id;
+                }
+            }
+            join_next = joined;
+            utf8_str = end;
+        }
+    }
+    void print_utf8(ColourSpec f, const char* utf8_str) { textcolour(f); print_utf8(utf8_str); }
+    void print_utf8(int x, int y, const char* utf8_str) { gotoxy(x, y); print_utf8(utf8_str); }
+    void print_utf8(int x, int y, ColourSpec f, const char* utf8_str) { gotoxy(x, y); textcolour(f); print_utf8(utf8_str); }
+    void print_utf8(int x, int y, ColourSpec f, ColourSpec b, const char* utf8_str) { gotoxy(x, y); textattr(f, b); print_utf8(utf8_str); }
+
+    void vprintf(const char* format, va_list args) {
+        char buffer[4096];
+        vsnprintf(buffer, sizeof(buffer), format, args);
+        print_utf8(buffer);
+    }
+
+    void printf(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+
+    void printf(int x, int y, const char* format, ...) {
+        gotoxy(x, y);
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+
+    void printf(int x, int y, ColourSpec f, ColourSpec b, const char* format, ...) {
+        gotoxy(x, y);
+        textattr(f, b);
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+
+    void printf(int x, int y, ColourSpec f, const char* format, ...) {
+        gotoxy(x, y);
+        textcolour(f);
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+};
+
+// Append a codepoint to a wide string (as a surrogate pair where wchar_t is 16 bits)
+inline void append_wide(std::wstring& out, char32_t cp) {
+    if (sizeof(wchar_t) == 2 && cp > 0xFFFF) {
+        cp -= 0x10000;
+        out += static_cast<wchar_t>(0xD800 + (cp >> 10));
+        out += static_cast<wchar_t>(0xDC00 + (cp & 0x3FF));
+    } else {
+        out += static_cast<wchar_t>(cp);
+    }
+}
+
+// A single-line label validated, decoded, measured and encoded once so it can
+// be drawn every frame without further per-character work. Holds the cells
+// for canvases, the wide-character text for ncurses and the Windows console,
+// and ready-made escape sequences for each colour depth.
+class PreparedText : public CellHolder {
+public:
+    // A stretch of text in one style, as an offset and length into wide()
+    struct Run {
+        uint32_t style;
+        size_t offset;
+        size_t length;
+    };
+
+private:
+    std::vector<Cell> cells_;
+    std::wstring wide_;
+    std::vector<Run> runs_;
+    std::string bytes_[2][4]; // indexed by terminal_defaults and ColourDepth
+
+public:
+    explicit PreparedText(const char* utf8_str, ColourSpec fg = Colour::WHITE,
+                          ColourSpec bg = Colour::BLACK, uint8_t attrs = ATTR_NONE) {
+        // Lay the text out on a scratch row wide enough for any result
+        int max_width = 2 * static_cast<int>(strlen(utf8_str));
+        Canvas scratch(max_width > 0 ? max_width : 1, 1);
+        scratch.textattr(fg, bg);
+        scratch.textstyle(attrs);
+        scratch.print_utf8(utf8_str);
+        cells_.assign(scratch.row(0), scratch.row(0) + scratch.wherex());
+
+        for (size_t i = 0; i < cells_.size(); i++) {
+            const Cell& cell = cells_[i];
+            if (cell.glyph == 0) continue;
+            if (runs_.empty() || runs_.back().style != cell.style) {
+                Run run = { cell.style, wide_.size(), 0 };
+                runs_.push_back(run);
+            }
+            std::string cluster = glyph_text(cell.glyph);
+            for (const char* p = cluster.c_str(); *p; ) append_wide(wide_, decode_utf8(p));
+            runs_.back().length = wide_.size() - runs_.back().offset;
+        }
+
+        for (int defaults = 0; defaults < 2; defaults++) {
+            for (int depth = 0; depth < 4; depth++) {
+                std::string& out = bytes_[defaults][depth];
+                append_cells(out, cells_.data(), 0, width() - 1, static_cast<ColourDepth>(depth), defaults != 0);
+                out += "\x1b[0m";
+            }
+        }
+    }
+
+    void mark_shared(SharedTableMarks& marks) const override {
+        for (size_t i = 0; i < cells_.size(); i++) marks.mark(cells_[i]);
+    }
+
+    // Width in terminal columns
+    int width() const { return static_cast<int>(cells_.size()); }
+    const Cell* cells() const { return cells_.data(); }
+    const std::wstring& wide() const { return wide_; }
+    const std::vector<Run>& runs() const { return runs_; }
+    // Styled text ready to write after positioning the cursor. With
+    // terminal_defaults, white on black is left in the terminal's own
+    // colours, as inline consoles draw it.
+    const std::string& bytes(ColourDepth depth, bool terminal_defaults = false) const {
+        return bytes_[terminal_defaults ? 1 : 0][static_cast<int>(depth)];
+    }
+};
+
+// Line styles for PreparedBox
+enum class BoxStyle {
+    SINGLE,
+    DOUBLE,
+    ROUNDED,
+    ASCII
+};
+
+// A box frame of fixed size prepared once: the top and bottom edges and the
+// two side characters. With fill set the interior is cleared as well.
+class PreparedBox {
+private:
+    int width_;
+    int height_;
+    PreparedText top_;
+    PreparedText middle_; // side, blank interior, side
+    PreparedText side_;
+    PreparedText bottom_;
+    bool fill_;
+
+    static std::string edge(const char* left, const char* line, const char* right, int width) {
+        std::string s = left;
+        for (int i = 2; i < width; i++) s += line;
+        if (width > 1) s += right;
+        return s;
+    }
+
+    static const char* const* chars(BoxStyle style) {
+        // top-left, top-right, bottom-left, bottom-right, horizontal, vertical
+        static const char* const single[6] = { "┌", "┐", "└", "┘", "─", "│" };
+        static const char* const dbl[6] = { "╔", "╗", "╚", "╝", "═", "║" };
+        static const char* const rounded[6] = { "╭", "╮", "╰", "╯", "─", "│" };
+        static const char* const ascii[6] = { "+", "+", "+", "+", "-", "|" };
+        switch (style) {
+        case BoxStyle::DOUBLE: return dbl;
+        case BoxStyle::ROUNDED: return rounded;
+        case BoxStyle::ASCII: return ascii;
+        default: return single;
+        }
+    }
+
+public:
+    PreparedBox(int width, int height, BoxStyle style = BoxStyle::SINGLE,
+                ColourSpec fg = Colour::WHITE, ColourSpec bg = Colour::BLACK, bool fill = false)
+        : width_(width), height_(height),
+          top_(edge(chars(style)[0], chars(style)[4], chars(style)[1], width).c_str(), fg, bg),
+          middle_(edge(chars(style)[5], " ", chars(style)[5], width).c_str(), fg, bg),
+          side_(chars(style)[5], fg, bg),
+          bottom_(edge(chars(style)[2], chars(style)[4], chars(style)[3], width).c_str(), fg, bg),
+          fill_(fill) {}
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    bool fill() const { return fill_; }
+    const PreparedText& top() const { return top_; }
+    const PreparedText& middle() const { return middle_; }
+    const PreparedText& side() const { return side_; }
+    const PreparedText& bottom() const { return bottom_; }
+};
+
+inline void Canvas::draw(int x, int y, const PreparedText& text) {
+    put_cells(x, y, text.cells(), text.width());
+}
+
+// Draw a prepared box on anything with draw(x, y, PreparedText)
+template <typename Target>
+inline void draw_box(Target& target, int x, int y, const PreparedBox& box) {
+    if (box.height() <= 0) return;
+    target.draw(x, y, box.top());
+    for (int row = 1; row < box.height() - 1; row++) {
+        if (box.fill() || box.width() < 2) {
+            target.draw(x, y + row, box.middle());
+        } else {
+            target.draw(x, y + row, box.side());
+            target.draw(x + box.width() - 1, y + row, box.side());
+        }
+    }
+    if (box.height() > 1) target.draw(x, y + box.height() - 1, box.bottom());
+}
+
+inline void Canvas::draw(int x, int y, const PreparedBox& box) {
+    draw_box(*this, x, y, box);
+}
+
+// A pane placed on screen at (x, y); higher z is drawn on top
+struct Layer {
+    int x;
+    int y;
+    int z;
+    Canvas canvas;
+
+    Layer(int x_, int y_, int width, int height, int z_)
+        : x(x_), y(y_), z(z_), canvas(width, height) {}
+};
+
+// Merges independently drawn layers into one frame in z order.
+// Each layer can be filled by a different thread (see DrawScope); only
+// compose() and the following present() run on the presenting thread.
+class Compositor {
+private:
+    std::vector<std::unique_ptr<Layer> > layers;
+    std::vector<Layer*> order;
+    Canvas frame;
+
+public:
+    Compositor() : frame(0, 0) {}
+
+    // Add a layer; the reference stays valid for the compositor's lifetime
+    Layer& add_layer(int x, int y, int width, int height, int z = 0) {
+        layers.push_back(std::unique_ptr<Layer>(new Layer(x, y, width, height, z)));
+        return *layers.back();
+    }
+
+    // Merge all layers into a width x height frame. Layers with equal z are
+    // drawn in the order they were added.
+    const Canvas& compose(int width, int height) {
+        if (frame.getwidth() != width || frame.getheight() != height) {
+            frame.resize(width, height);
+        } else {
+            frame.resetattr();
+            frame.clrscr();
+        }
+        order.clear();
+        for (size_t i = 0; i < layers.size(); i++) order.push_back(layers[i].get());
+        std::stable_sort(order.begin(), order.end(),
+                         [](const Layer* a, const Layer* b) { return a->z < b->z; });
+        for (size_t i = 0; i < order.size(); i++) {
+            frame.blit(order[i]->canvas, order[i]->x, order[i]->y);
+        }
+        return frame;
+    }
+};
+
+// Maps (fg, bg) colour-number combinations onto a bounded range of colour
+// pairs, recycling a pair once the range is full. The caller reports how
+// many cells on screen use each pair (add_use/drop_use), and pairs no cell
+// uses are kept on an idle list in least recently used order, so the pair
+// to recycle is found in O(1). Hits are a hash lookup and a list splice;
+// the caller only needs to define the pair (init_pair) when get() reports a
+// miss.
+class PairAllocator {
+private:
+    struct Entry {
+        uint64_t key;
+        int pair;
+    };
+    std::list<Entry> lru; // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> lookup;
+    // Indexed by pair - first_pair, grown as pairs are first handed out
+    std::vector<std::list<Entry>::iterator> entries;
+    std::vector<uint32_t> uses;          // cells showing the pair
+    std::vector<unsigned char> pinned;   // used by output whose cells are not counted
+    std::list<int> idle;                 // handed-out pairs no cell uses, least recently used first
+    std::vector<std::list<int>::iterator> idle_at;
+    std::vector<unsigned char> is_idle;
+    int first_pair;
+    int capacity;
+
+    bool can_idle(int slot) const { return uses[slot] == 0 && !pinned[slot]; }
+
+    // Put slot at the most recently used end of the idle list
+    void touch_idle(int slot) {
+        if (is_idle[slot]) {
+            idle.splice(idle.end(), idle, idle_at[slot]);
+        } else {
+            idle_at[slot] = idle.insert(idle.end(), slot);
+            is_idle[slot] = 1;
+        }
+    }
+
+    void leave_idle(int slot) {
+        if (!is_idle[slot]) return;
+        idle.erase(idle_at[slot]);
+        is_idle[slot] = 0;
+    }
+
+public:
+    PairAllocator() : first_pair(1), capacity(0) {}
+
+    // Hand out pairs first_pair .. first_pair + count - 1
+    void reset(int first, int count) {
+        lru.clear();
+        lookup.clear();
+        idle.clear();
+        entries.clear();
+        uses.clear();
+        pinned.clear();
+        idle_at.clear();
+        is_idle.clear();
+        first_pair = first;
+        capacity = count > 0 ? count : 0;
+    }
+
+    static uint64_t make_key(int fg, int bg) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(fg)) << 32) | static_cast<uint32_t>(bg);
+    }
+
+    // Another cell on screen now shows pair
+    void add_use(int pair) {
+        int slot = pair - first_pair;
+        if (slot < 0 || slot >= static_cast<int>(uses.size())) return;
+        uses[slot]++;
+        leave_idle(slot);
+    }
+
+    // A cell on screen that showed pair has been overwritten
+    void drop_use(int pair) {
+        int slot = pair - first_pair;
+        if (slot < 0 || slot >= static_cast<int>(uses.size()) || uses[slot] == 0) return;
+        if (--uses[slot] == 0 && !pinned[slot]) touch_idle(slot);
+    }
+
+    // Never recycle pair until clear_uses(), for output whose cells are not
+    // counted with add_use
+    void pin(int pair) {
+        int slot = pair - first_pair;
+        if (slot < 0 || slot >= static_cast<int>(uses.size())) return;
+        pinned[slot] = 1;
+        leave_idle(slot);
+    }
+
+    // The screen was cleared: no cell uses any pair
+    void clear_uses() {
+        std::fill(uses.begin(), uses.end(), 0);
+        std::fill(pinned.begin(), pinned.end(), 0);
+        // Re-queue every handed-out pair, oldest first
+        for (std::list<Entry>::reverse_iterator r = lru.rbegin(); r != lru.rend(); ++r) {
+            touch_idle(r->pair - first_pair);
+        }
+    }
+
+    // Pair for (fg, bg). needs_init is set when the pair has to be (re)defined,
+    // evicted when that pair previously held another combination, and
+    // on_screen when that combination was still shown by some cell (the
+    // least recently used pair is recycled when every pair is in use).
+    // Returns 0 (the terminal's default colours) if there is no pair space
+    // at all.
+    int get(int fg, int bg, bool& needs_init, bool& evicted, bool& on_screen) {
+        uint64_t key = make_key(fg, bg);
+        needs_init = false;
+        evicted = false;
+        on_screen = false;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator>::iterator it = lookup.find(key);
+        if (it != lookup.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            int slot = it->second->pair - first_pair;
+            if (is_idle[slot]) touch_idle(slot);
+            return it->second->pair;
+        }
+        if (capacity == 0) return 0;
+
+        int pair;
+        if (static_cast<int>(lru.size()) < capacity) {
+            pair = first_pair + static_cast<int>(lru.size());
+            entries.push_back(std::list<Entry>::iterator());
+            uses.push_back(0);
+            pinned.push_back(0);
+            idle_at.push_back(std::list<int>::iterator());
+            is_idle.push_back(0);
+        } else {
+            std::list<Entry>::iterator victim = idle.empty() ? --lru.end() : entries[idle.front()];
+            pair = victim->pair;
+            lookup.erase(victim->key);
+            lru.erase(victim);
+            evicted = true;
+            on_screen = idle.empty();
+        }
+        Entry entry = { key, pair };
+        lru.push_front(entry);
+        lookup[key] = lru.begin();
+        int slot = pair - first_pair;
+        entries[slot] = lru.begin();
+        if (can_idle(slot)) touch_idle(slot);
+        needs_init = true;
+        return pair;
+    }
+};
+
+// A key read by getkey(). Special keys (arrows, function keys, KEY_RESIZE,
+// ...) have special set and code holding the key code: a KEY_* constant
+// from ncurses, or the key's scan code on Windows.
+// Otherwise code is the character typed.
+struct Key {
+    wint_t code;
+    bool special;
+};
+
+// Counters kept by each console
+struct ConsoleStats {
+    uint64_t frames_presented;  // calls to present()
+    uint64_t rows_skipped;      // rows whose hash matched the front buffer
+    uint64_t cells_compared;    // cells of changed rows diffed against the front buffer
+    uint64_t cells_written;     // cells actually sent to the terminal
+    uint64_t pair_evictions;    // colour pairs recycled by the pair allocator
+    uint64_t startup_ns;        // time spent opening the console
+    uint64_t deferred_init_ns;  // time spent later on setup deferred by InitConfig
+};
+
+// Options for opening a console. The defaults match init(): a full-screen
+// terminal set up completely before the constructor returns.
+struct InitConfig {
+    // Draw in place below the cursor instead of taking over the screen.
+    // No alternate screen and no ncurses: output is written as escape
+    // sequences, and gotoxy() rows count from the line the console started
+    // on. Meant for short-lived tools showing a spinner or a coloured summary.
+    bool inline_mode;
+    // Set up colour support (start_color and the colour pairs) on first use
+    // of a colour rather than at startup
+    bool lazy_colour;
+    // Inline mode: load the terminal's key sequences from terminfo on the
+    // first key read rather than at startup
+    bool lazy_terminfo;
+
+    InitConfig() : inline_mode(false), lazy_colour(false), lazy_terminfo(true) {}
+};
+
+// Nanoseconds since start, for the startup figures in ConsoleStats
+inline uint64_t elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+}
+
+#ifndef _WIN32
+// Colour depth guessed from $COLORTERM and the terminal type, for output
+// written as escape sequences without ncurses
+inline ColourDepth env_colour_depth(const char* term) {
+    const char* colorterm = getenv("COLORTERM");
+    if (!term) term = getenv("TERM");
+    if (colorterm && (strcmp(colorterm, "truecolor") == 0 || strcmp(colorterm, "24bit") == 0)) {
+        return ColourDepth::TRUECOLOUR;
+    }
+    if (term && strstr(term, "direct")) return ColourDepth::TRUECOLOUR;
+    if (term && strstr(term, "256")) return ColourDepth::COLOURS_256;
+    if (term && *term && strcmp(term, "dumb") != 0 && strcmp(term, "vt100") != 0) return ColourDepth::COLOURS_16;
+    return ColourDepth::COLOURS_8;
+}
+
+// Escape sequences sent by special keys, for inline mode which decodes input
+// itself. The terminfo entry is read once per terminal type; the common
+// xterm/VT sequences are always recognised as well.
+typedef std::vector<std::pair<std::string, int> > KeyTable;
+
+inline const KeyTable& key_table(const std::string& term_type, int fd) {
+    static std::unordered_map<std::string, KeyTable> tables;
+    std::lock_guard<std::recursive_mutex> lock(get_curses_mutex());
+    std::unordered_map<std::string, KeyTable>::iterator found = tables.find(term_type);
+    if (found != tables.end()) return found->second;
+    KeyTable& keys = tables[term_type];
+
+    static const struct { const char* name; int key; } caps[] = {
+        {"kcuu1", KEY_UP}, {"kcud1", KEY_DOWN}, {"kcub1", KEY_LEFT}, {"kcuf1", KEY_RIGHT},
+        {"khome", KEY_HOME}, {"kend", KEY_END}, {"kich1", KEY_IC}, {"kdch1", KEY_DC},
+        {"kpp", KEY_PPAGE}, {"knp", KEY_NPAGE}, {"kcbt", KEY_BTAB}, {"kent", KEY_ENTER},
+        {"kf1", KEY_F(1)}, {"kf2", KEY_F(2)}, {"kf3", KEY_F(3)}, {"kf4", KEY_F(4)},
+        {"kf5", KEY_F(5)}, {"kf6", KEY_F(6)}, {"kf7", KEY_F(7)}, {"kf8", KEY_F(8)},
+        {"kf9", KEY_F(9)}, {"kf10", KEY_F(10)}, {"kf11", KEY_F(11)}, {"kf12", KEY_F(12)}
+    };
+    int err = 0;
+    // setupterm replaces cur_term; full-screen consoles restore their own
+    // in select(), so this is safe alongside them
+    if (setupterm(term_type.empty() ? nullptr : term_type.c_str(), fd, &err) == OK) {
+        for (size_t i = 0; i < sizeof(caps) / sizeof(caps[0]); i++) {
+            char* seq = tigetstr(const_cast<char*>(caps[i].name));
+            if (seq && seq != reinterpret_cast<char*>(-1) && seq[0] == '\x1b') keys.push_back(std::make_pair(std::string(seq), caps[i].key));
+        }
+    }
+
+    static const struct { const char* seq; int key; } ansi[] = {
+        {"\x1b[A", KEY_UP}, {"\x1b[B", KEY_DOWN}, {"\x1b[C", KEY_RIGHT}, {"\x1b[D", KEY_LEFT},
+        {"\x1bOA", KEY_UP}, {"\x1bOB", KEY_DOWN}, {"\x1bOC", KEY_RIGHT}, {"\x1bOD", KEY_LEFT},
+        {"\x1b[H", KEY_HOME}, {"\x1b[F", KEY_END}, {"\x1bOH", KEY_HOME}, {"\x1bOF", KEY_END},
+        {"\x1b[1~", KEY_HOME}, {"\x1b[4~", KEY_END}, {"\x1b[2~", KEY_IC}, {"\x1b[3~", KEY_DC},
+        {"\x1b[5~", KEY_PPAGE}, {"\x1b[6~", KEY_NPAGE}, {"\x1b[Z", KEY_BTAB}, {"\x1bOM", KEY_ENTER},
+        {"\x1bOP", KEY_F(1)}, {"\x1bOQ", KEY_F(2)}, {"\x1bOR", KEY_F(3)}, {"\x1bOS", KEY_F(4)},
+        {"\x1b[15~", KEY_F(5)}, {"\x1b[17~", KEY_F(6)}, {"\x1b[18~", KEY_F(7)}, {"\x1b[19~", KEY_F(8)},
+        {"\x1b[20~", KEY_F(9)}, {"\x1b[21~", KEY_F(10)}, {"\x1b[23~", KEY_F(11)}, {"\x1b[24~", KEY_F(12)}
+    };
+    for (size_t i = 0; i < sizeof(ansi) / sizeof(ansi[0]); i++) {
+        keys.push_back(std::make_pair(std::string(ansi[i].seq), ansi[i].key));
+    }
+    return keys;
+}
+#endif
+
+// A single terminal. The default instance (see init()) drives the process's
+// own terminal; further instances can be opened on other terminals such as
+// ptys or sockets, each with its own screen, input decoding and colours.
+class Console {
+private:
+#ifdef _WIN32
+    HANDLE hConsole;
+    HANDLE hInput;
+    WORD defaultAttrs;
+    bool vt; // virtual terminal sequences enabled (Windows 10 and later)
+    // A key press read from hInput; prefix is the 0 or 0xE0 that getchar()
+    // returns before the scan code of a key without a character
+    struct InputKey {
+        Key key;
+        wint_t prefix;
+    };
+    std::vector<InputKey> keys_read; // read ahead by kbhit() or key repeats
+    std::string bytes_pending;       // rest of a key for getchar()
+    std::wstring wide_pending;       // rest of a key for getwchar()
+#else
+    SCREEN* screen;
+    WINDOW* win;
+    FILE* out_file;
+    FILE* in_file;
+    int in_fd;
+    PairAllocator pairs;
+    std::vector<int> cell_pairs; // pair each window cell was last drawn with by present()
+    int pair_cols;               // window size cell_pairs is laid out for
+    int pair_rows;
+    bool colour_active; // immediate-mode colours set since the last resetattr()
+    bool colour_ready;  // start_color() called and the pair allocator sized
+
+    // Inline mode (see InitConfig)
+    bool inline_mode;
+    std::string term_name;   // terminal type for the key table, empty for $TERM
+    std::string out_buf;     // escape sequences built up by the current call
+    int row;                 // cursor row, counted from the starting line
+    int rows_used;           // lowest row the cursor has reached
+    bool line_start;         // cursor is at the start of a fresh line
+    uint8_t sgr_set;         // immediate colours in effect: 1 foreground, 2 background
+    bool cursor_hidden;
+    bool raw_input;          // terminal switched to unbuffered, unechoed input
+    struct termios saved_termios;
+    const KeyTable* keys;    // special key sequences, loaded on first use if lazy
+    std::string pending;     // input read ahead while matching a key sequence
+#endif
+    ColourDepth depth;
+    bool initialized;
+    ColourSpec fg;
+    ColourSpec bg;
+    Canvas front; // what this terminal currently shows, as far as present() knows
+    std::vector<uint64_t> front_hashes; // row hashes of the frames that produced front
+    int hashed_width;                   // frame width those hashes were taken at
+    bool front_valid;
+    bool colours_lost; // a recycled colour pair changed cells already on screen
+    ConsoleStats stats_;
+    int known_cols;  // terminal size as of the last check_resize()
+    int known_rows;
+
+#ifndef _WIN32
+    // Select this console's screen for the following curses calls
+    std::unique_lock<std::recursive_mutex> select() const {
+        std::unique_lock<std::recursive_mutex> lock(get_curses_mutex());
+        if (screen) set_term(screen);
+        return lock;
+    }
+
+    void setup(const InitConfig& config, const char* term_type) {
+        colour_active = false;
+        colour_ready = false;
+        pair_cols = pair_rows = 0;
+        inline_mode = config.inline_mode;
+        term_name = term_type ? term_type : "";
+        row = rows_used = 0;
+        line_start = true;
+        sgr_set = 0;
+        cursor_hidden = false;
+        raw_input = false;
+        keys = nullptr;
+    }
+
+    void open(const char* term_type, const InitConfig& config) {
+        if (inline_mode) {
+            open_inline(config);
+            return;
+        }
+        screen = newterm(term_type, out_file, in_file);
+        if (!screen) return;
+        set_term(screen);
+        win = stdscr;
+        in_fd = fileno(in_file);
+
+        cbreak();
+        noecho();
+        keypad(win, TRUE);
+        curs_set(1);
+        initialized = true;
+
+        // Terminals whose terminfo entry has the RGB flag (e.g. xterm-direct)
+        // take 24-bit colour numbers directly. Read from terminfo so the depth
+        // is known before start_color() has run.
+        char colors_cap[] = "colors";
+        char rgb_cap[] = "RGB";
+        int colours = tigetnum(colors_cap);
+        if (colours >= 0x1000000 && tigetflag(rgb_cap) > 0) depth = ColourDepth::TRUECOLOUR;
+        else if (colours >= 256) depth = ColourDepth::COLOURS_256;
+        else if (colours >= 16) depth = ColourDepth::COLOURS_16;
+        else depth = ColourDepth::COLOURS_8;
+
+        if (!config.lazy_colour) init_colour();
+    }
+
+    void init_colour() {
+        colour_ready = true;
+        start_color();
+        int pair_space = COLOR_PAIRS - 1;
+#if !defined(NCURSES_EXT_COLORS)
+        if (pair_space > 32766) pair_space = 32766;
+#endif
+        pairs.reset(1, pair_space < MAX_COLOUR_PAIRS ? pair_space : MAX_COLOUR_PAIRS);
+    }
+
+    // Inline mode needs no ncurses screen: only the locale for character
+    // widths, and a colour depth guessed from the environment
+    void open_inline(const InitConfig& config) {
+        in_fd = fileno(in_file);
+        depth = env_colour_depth(term_name.empty() ? nullptr : term_name.c_str());
+        if (!config.lazy_terminfo) keys = &key_table(term_name, fileno(out_file));
+        initialized = true;
+    }
+
+    // Queue text, keeping track of the rows it moves the cursor down
+    void emit(const char* text, size_t length) {
+        if (length == 0) return;
+        for (size_t i = 0; i < length; i++) {
+            if (text[i] == '\n') row++;
+        }
+        if (row > rows_used) rows_used = row;
+        line_start = text[length - 1] == '\n';
+        out_buf.append(text, length);
+    }
+
+    // Send the queued output with a single write
+    void flush() {
+        if (out_buf.empty()) return;
+        fflush(out_file); // keep order with anything the caller wrote through stdio
+        int fd = fileno(out_file);
+        const char* p = out_buf.data();
+        size_t left = out_buf.size();
+        while (left > 0) {
+            ssize_t n = ::write(fd, p, left);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            p += n;
+            left -= static_cast<size_t>(n);
+        }
+        out_buf.clear();
+    }
+
+    // Move the cursor relative to the starting line. Moving below the lowest
+    // row used so far adds lines, scrolling the terminal if need be.
+    void move_to(int x, int y) {
+        char seq[24];
+        if (y < 0) y = 0;
+        if (y < row) {
+            snprintf(seq, sizeof(seq), "\x1b[%dA", row - y);
+            out_buf += seq;
+        } else if (y > row) {
+            out_buf.append(y - row, '\n');
+        }
+        row = y;
+        if (row > rows_used) rows_used = row;
+        line_start = false;
+        snprintf(seq, sizeof(seq), "\x1b[%dG", x + 1);
+        out_buf += seq;
+    }
+
+    // Queue the escape sequence restoring the immediate-mode colours. Only
+    // colours that were set are sent, so the terminal's own default
+    // background shows through text that only set a foreground colour.
+    void append_colours() {
+        out_buf += "\x1b[0";
+        if (sgr_set & 1) {
+            out_buf += ';';
+            append_sgr_colour(out_buf, fg, false, depth);
+        }
+        if (sgr_set & 2) {
+            out_buf += ';';
+            append_sgr_colour(out_buf, bg, true, depth);
+        }
+        out_buf += 'm';
+    }
+
+    // Switch the terminal to unbuffered, unechoed input on first read
+    void start_input() {
+        if (raw_input || tcgetattr(in_fd, &saved_termios) != 0) return;
+        struct termios raw = saved_termios;
+        raw.c_lflag &= ~(ICANON | ECHO);
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        raw_input = tcsetattr(in_fd, TCSANOW, &raw) == 0;
+    }
+
+    // Next input byte, waiting up to timeout_ms (-1 waits indefinitely);
+    // -1 if none arrived
+    int read_byte(int timeout_ms) {
+        if (!pending.empty()) {
+            int b = static_cast<unsigned char>(pending[0]);
+            pending.erase(0, 1);
+            return b;
+        }
+        struct pollfd pfd = { in_fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout_ms) <= 0) return -1;
+        unsigned char b;
+        return ::read(in_fd, &b, 1) == 1 ? b : -1;
+    }
+
+    // Longest a key sequence may take to arrive after its ESC
+    static const int ESCAPE_DELAY_MS = 25;
+
+    // Decode a key in inline mode: special keys become KEY_* codes and, for
+    // the wide functions, UTF-8 sequences become one character
+    int read_key_inline(bool echo_input, wint_t* wide) {
+        if (!keys) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            keys = &key_table(term_name, fileno(out_file));
+            stats_.deferred_init_ns += elapsed_ns(start);
+        }
+        start_input();
+        int b = read_byte(-1);
+        if (b < 0) return ERR;
+
+        std::string seq(1, static_cast<char>(b));
+        if (b == 0x1b) {
+            for (;;) {
+                bool prefix = false;
+                for (size_t i = 0; i < keys->size(); i++) {
+                    const std::string& candidate = (*keys)[i].first;
+                    if (candidate == seq) {
+                        if (wide) *wide = static_cast<wint_t>((*keys)[i].second);
+                        return wide ? KEY_CODE_YES : (*keys)[i].second;
+                    }
+                    if (candidate.compare(0, seq.size(), seq) == 0) prefix = true;
+                }
+                int next = prefix ? read_byte(ESCAPE_DELAY_MS) : -1;
+                if (next < 0) break;
+                seq += static_cast<char>(next);
+            }
+            // Not a known key: hand back the ESC and keep the rest for later
+            pending.insert(0, seq, 1, std::string::npos);
+            seq.resize(1);
+        } else if (wide && b >= 0xC0) {
+            int more = b >= 0xF0 ? 3 : b >= 0xE0 ? 2 : 1;
+            for (int i = 0; i < more; i++) {
+                int next = read_byte(-1);
+                if (next < 0) break;
+                seq += static_cast<char>(next);
+            }
+        }
+
+        if (echo_input && b >= 0x20 && b != 0x7F) {
+            std::unique_lock<std::recursive_mutex> lock = select();
+            emit(seq.data(), seq.size());
+            flush();
+        }
+        if (!wide) return b;
+        const char* p = seq.c_str();
+        *wide = static_cast<wint_t>(decode_utf8(p));
+        return OK;
+    }
+
+    // ncurses colour number for c at this terminal's depth. On 8-colour
+    // terminals bright colours are approximated with bold.
+    int curses_colour(ColourSpec c, bool& bold) const {
+        if (depth == ColourDepth::TRUECOLOUR) {
+            if (c.kind() == ColourSpec::BASIC && ansi_index(c.basic()) < 8) return ansi_index(c.basic());
+            Rgb rgb = c.kind() == ColourSpec::RGB ? c.rgb()
+                    : palette_rgb(c.kind() == ColourSpec::PALETTE ? c.index() : ansi_index(c.basic()));
+            int packed = (rgb.r << 16) | (rgb.g << 8) | rgb.b;
+            return packed < 8 ? 8 : packed; // numbers below 8 select the ANSI colours
+        }
+        if (depth == ColourDepth::COLOURS_256 && c.kind() != ColourSpec::BASIC) {
+            return c.kind() == ColourSpec::RGB ? nearest_256(c.rgb()) : c.index();
+        }
+        int ansi = ansi_index(to_basic(c));
+        if (ansi >= 8 && depth == ColourDepth::COLOURS_8) {
+            bold = true;
+            return ansi - 8;
+        }
+        return ansi;
+    }
+
+    // Lay cell_pairs out for a cols x rows window, keeping the cells still
+    // on screen and dropping the uses of those cut off
+    void fit_cell_pairs(int cols, int rows) {
+        if (cols == pair_cols && rows == pair_rows) return;
+        std::vector<int> fitted(static_cast<size_t>(cols) * rows, 0);
+        for (int y = 0; y < pair_rows; y++) {
+            for (int x = 0; x < pair_cols; x++) {
+                int pair = cell_pairs[y * pair_cols + x];
+                if (x < cols && y < rows) fitted[y * cols + x] = pair;
+                else pairs.drop_use(pair);
+            }
+        }
+        cell_pairs.swap(fitted);
+        pair_cols = cols;
+        pair_rows = rows;
+    }
+
+    // Colour pair for a colour combination; only a new combination calls
+    // init_pair. When the allocator is full it recycles the least recently
+    // used pair no cell on screen shows, so what is already shown keeps its
+    // colours. Cells drawn by present() are counted per pair (counted is set
+    // by draw_cell); pairs used by immediate-mode output are kept until
+    // clrscr(), since its cells are not tracked. If every pair is in use,
+    // the cells showing the recycled one change colour with it, and the next
+    // present() repaints everything.
+    int colour_pair(ColourSpec f, ColourSpec b, bool& bold, bool counted = false) {
+        if (!colour_ready) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            init_colour();
+            stats_.deferred_init_ns += elapsed_ns(start);
+        }
+        bool unused = false;
+        int fg_num = curses_colour(f, bold);
+        int bg_num = curses_colour(b, unused);
+        bool needs_init, evicted, on_screen;
+        int pair = pairs.get(fg_num, bg_num, needs_init, evicted, on_screen);
+        if (needs_init) {
+#if defined(NCURSES_EXT_COLORS)
+            init_extended_pair(pair, fg_num, bg_num);
+#else
+            init_pair(static_cast<short>(pair), static_cast<short>(fg_num), static_cast<short>(bg_num));
+#endif
+        }
+        if (evicted) {
+            stats_.pair_evictions++;
+            if (on_screen) {
+                front_valid = false;
+                colours_lost = true;
+            }
+        }
+        if (!counted) pairs.pin(pair);
+        return pair;
+    }
+
+    // Apply the immediate-mode colours to the window. Called before each
+    // output so a pair recycled in the meantime is looked up again.
+    void apply_colour() {
+        if (!colour_active) return;
+        bool bold = false;
+        int pair = colour_pair(fg, bg, bold);
+#if defined(NCURSES_EXT_COLORS)
+        wattr_set(win, bold ? A_BOLD : A_NORMAL, static_cast<short>(pair), &pair);
+#else
+        wattr_set(win, bold ? A_BOLD : A_NORMAL, static_cast<short>(pair), nullptr);
+#endif
+    }
+
+    void draw_cell(int x, int y, const Cell& cell) {
+        const Style& style = style_table()[cell.style];
+        wchar_t wc[CCHARW_MAX + 1];
+        int len = 0;
+        if (cell.glyph & Cell::EXTENDED) {
+            const char* p = grapheme_table()[cell.glyph & ~Cell::EXTENDED].c_str();
+            while (*p && len < CCHARW_MAX) wc[len++] = static_cast<wchar_t>(decode_utf8(p));
+        } else {
+            wc[len++] = static_cast<wchar_t>(cell.glyph);
+        }
+        wc[len] = L'\0';
+
+        // The cells overwritten no longer hold their pairs, so one of those
+        // may be the pair recycled for this cell
+        int span = x + 1 < pair_cols && char_width(glyph_base(cell.glyph)) > 1 ? 2 : 1;
+        int* used = &cell_pairs[y * pair_cols + x];
+        for (int i = 0; i < span; i++) pairs.drop_use(used[i]);
+        bool bold = (style.attrs & ATTR_BOLD) != 0;
+        int pair = colour_pair(style.fg, style.bg, bold, true);
+        for (int i = 0; i < span; i++) {
+            used[i] = pair;
+            pairs.add_use(pair);
+        }
+        attr_t attrs = bold ? A_BOLD : A_NORMAL;
+        if (style.attrs & ATTR_UNDERLINE) attrs |= A_UNDERLINE;
+        if (style.attrs & ATTR_REVERSE) attrs |= A_REVERSE;
+#if defined(NCURSES_EXT_COLORS)
+        void* opts = &pair;
+#else
+        void* opts = nullptr;
+#endif
+        cchar_t cc;
+        if (setcchar(&cc, wc, attrs, static_cast<short>(pair), opts) == ERR) {
+            // Cluster ncurses can't hold in one cell: fall back to its base
+            wc[1] = L'\0';
+            setcchar(&cc, wc, attrs, static_cast<short>(pair), opts);
+        }
+        mvwadd_wch(win, y, x, &cc);
+    }
+
+    // Read a key, waiting on the input fd without holding the curses lock so
+    // a blocked reader does not stall drawing on other consoles
+    int read_key(bool echo_input, wint_t* wide) {
+        for (;;) {
+            {
+                std::unique_lock<std::recursive_mutex> lock = select();
+                nodelay(win, TRUE);
+                if (echo_input) echo();
+                int ch;
+                int result;
+                if (wide) {
+                    result = wget_wch(win, wide);
+                    ch = result;
+                } else {
+                    ch = wgetch(win);
+                    result = ch;
+                }
+                if (echo_input) noecho();
+                nodelay(win, FALSE);
+                if (result != ERR) return ch;
+            }
+            struct pollfd pfd = { in_fd, POLLIN, 0 };
+            poll(&pfd, 1, -1);
+        }
+    }
+#endif
+
+#ifdef _WIN32
+    // Turn on virtual terminal sequences so 256-colour and RGB output can be
+    // sent as SGR codes; older consoles keep using the 16 legacy attributes
+    void enable_vt() {
+        vt = false;
+        depth = ColourDepth::COLOURS_16;
+        DWORD mode;
+        if (GetConsoleMode(hConsole, &mode) &&
+            SetConsoleMode(hConsole, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING)) {
+            vt = true;
+            depth = ColourDepth::TRUECOLOUR;
+        }
+    }
+
+    void write_sgr(const Style& style) {
+        std::string sgr;
+        append_sgr(sgr, style, depth);
+        DWORD written;
+        WriteConsoleA(hConsole, sgr.data(), static_cast<DWORD>(sgr.size()), &written, NULL);
+    }
+
+    // Next key press on this console's input handle. Input records that are
+    // not key presses (releases, modifiers alone, focus, mouse, resize) are
+    // dropped. Without wait, returns false once no record is queued.
+    bool read_input(InputKey& out, bool wait) {
+        if (!keys_read.empty()) {
+            out = keys_read.front();
+            keys_read.erase(keys_read.begin());
+            return true;
+        }
+        for (;;) {
+            INPUT_RECORD record;
+            DWORD count = 0;
+            if (!wait && (!PeekConsoleInputW(hInput, &record, 1, &count) || count == 0)) return false;
+            if (!ReadConsoleInputW(hInput, &record, 1, &count) || count == 0) return false;
+            if (record.EventType != KEY_EVENT || !record.Event.KeyEvent.bKeyDown) continue;
+            const KEY_EVENT_RECORD& event = record.Event.KeyEvent;
+            InputKey input;
+            if (event.uChar.UnicodeChar != 0) {
+                input.key.code = event.uChar.UnicodeChar;
+                input.key.special = false;
+                input.prefix = 0;
+            } else {
+                switch (event.wVirtualKeyCode) {
+                case VK_SHIFT: case VK_CONTROL: case VK_MENU: case VK_CAPITAL:
+                case VK_NUMLOCK: case VK_SCROLL: case VK_LWIN: case VK_RWIN:
+                    continue;
+                }
+                input.key.code = event.wVirtualScanCode;
+                input.key.special = true;
+                input.prefix = (event.dwControlKeyState & ENHANCED_KEY) ? 0xE0 : 0;
+            }
+            for (WORD i = 1; i < event.wRepeatCount; i++) keys_read.push_back(input);
+            out = input;
+            return true;
+        }
+    }
+
+    void echo_char(char32_t cp) {
+        if (cp < 0x20 || cp == 0x7F) return;
+        std::wstring text;
+        append_wide(text, cp);
+        DWORD written;
+        WriteConsoleW(hConsole, text.data(), static_cast<DWORD>(text.size()), &written, NULL);
+    }
+
+    // Key for the wide character functions: a UTF-16 unit, or the prefix
+    // with the scan code kept back for the next call, as _getwch() does
+    wint_t read_wide(bool echo_input) {
+        if (!wide_pending.empty()) {
+            wint_t wc = wide_pending[0];
+            wide_pending.erase(0, 1);
+            return wc;
+        }
+        InputKey input;
+        if (!read_input(input, true)) return WEOF;
+        if (input.key.special) {
+            wide_pending = static_cast<wchar_t>(input.key.code);
+            return input.prefix;
+        }
+        if (echo_input && (input.key.code < 0xD800 || input.key.code >= 0xE000)) echo_char(input.key.code);
+        return input.key.code;
+    }
+
+    // As read_wide(), one UTF-8 byte at a time
+    int read_byte(bool echo_input) {
+        if (bytes_pending.empty()) {
+            InputKey input;
+            if (!read_input(input, true)) return -1;
+            if (input.key.special) {
+                bytes_pending = static_cast<char>(input.key.code);
+                return static_cast<int>(input.prefix);
+            }
+            char32_t cp = input.key.code;
+            if (cp >= 0xD800 && cp < 0xDC00) {
+                // High surrogate: the low half follows in the next record
+                InputKey low;
+                if (read_input(low, true) && low.key.code >= 0xDC00 && low.key.code < 0xE000) {
+                    cp = 0x10000 + ((cp - 0xD800) << 10) + (low.key.code - 0xDC00);
+                }
+            }
+            if (echo_input) echo_char(cp);
+            encode_utf8(cp, bytes_pending);
+        }
+        int b = static_cast<unsigned char>(bytes_pending[0]);
+        bytes_pending.erase(0, 1);
+        return b;
+    }
+#endif
+
+    // Upper bound on colour pairs handed out by the pair allocator: pair
+    // numbers up to 65535, as ncurses offers for 256-colour terminals. The
+    // allocator only grows its bookkeeping as pairs are first used.
+    static const int MAX_COLOUR_PAIRS = 65535;
+
+public:
+    // Open the process's own terminal
+    explicit Console(const InitConfig& config = InitConfig())
+        : depth(ColourDepth::COLOURS_8), initialized(false), fg(Colour::WHITE), bg(Colour::BLACK),
+          front(0, 0), hashed_width(-1), front_valid(false), colours_lost(false), stats_(),
+          known_cols(-1), known_rows(-1) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#ifdef _WIN32
+        hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+        hInput = GetStdHandle(STD_INPUT_HANDLE);
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        GetConsoleScreenBufferInfo(hConsole, &csbi);
+        defaultAttrs = csbi.wAttributes;
+        // Set UTF-8 code page for Unicode support
+        SetConsoleOutputCP(CP_UTF8);
+        SetConsoleCP(CP_UTF8);
+        enable_vt();
+        initialized = true;
+        (void)config; // the Windows console always draws in place
+#else
+        screen = nullptr;
+        win = nullptr;
+        out_file = stdout;
+        in_file = stdin;
+        in_fd = -1;
+        setup(config, nullptr);
+
+        // Set locale for UTF-8 support before initializing ncurses; inline
+        // mode only sets the character type, for the program's own wide output
+        setlocale(inline_mode ? LC_CTYPE : LC_ALL, "");
+
+        std::lock_guard<std::recursive_mutex> lock(get_curses_mutex());
+        open(nullptr, config);
+#endif
+        stats_.startup_ns = elapsed_ns(start);
+    }
+
+#ifdef _WIN32
+    // Open a console on explicit screen buffer and input handles
+    Console(HANDLE output, HANDLE input)
+        : hConsole(output), hInput(input), vt(false), depth(ColourDepth::COLOURS_16), initialized(false),
+          fg(Colour::WHITE), bg(Colour::BLACK), front(0, 0), hashed_width(-1), front_valid(false), colours_lost(false), stats_(),
+          known_cols(-1), known_rows(-1) {
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return;
+        defaultAttrs = csbi.wAttributes;
+        enable_vt();
+        initialized = true;
+    }
+#else
+    // Open a console on another terminal, e.g. the slave side of a pty or a
+    // connected socket. The descriptors are duplicated, so the caller keeps
+    // ownership of its own. term_type defaults to $TERM.
+    Console(int input_fd, int output_fd, const char* term_type = nullptr, const InitConfig& config = InitConfig())
+        : screen(nullptr), win(nullptr), out_file(nullptr), in_file(nullptr),
+          in_fd(-1), depth(ColourDepth::COLOURS_8), initialized(false),
+          fg(Colour::WHITE), bg(Colour::BLACK), front(0, 0), hashed_width(-1), front_valid(false), colours_lost(false), stats_(),
+          known_cols(-1), known_rows(-1) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        setup(config, term_type);
+        int in_dup = dup(input_fd);
+        int out_dup = dup(output_fd);
+        if (in_dup >= 0) in_file = fdopen(in_dup, "r");
+        if (out_dup >= 0) out_file = fdopen(out_dup, "w");
+        if (!in_file || !out_file) {
+            if (in_file) fclose(in_file); else if (in_dup >= 0) close(in_dup);
+            if (out_file) fclose(out_file); else if (out_dup >= 0) close(out_dup);
+            in_file = out_file = nullptr;
+            return;
+        }
+
+        std::lock_guard<std::recursive_mutex> lock(get_curses_mutex());
+        open(term_type, config);
+        stats_.startup_ns = elapsed_ns(start);
+    }
+#endif
+
+    ~Console() {
+#ifdef _WIN32
+        if (initialized) {
+            SetConsoleTextAttribute(hConsole, defaultAttrs);
+        }
+#else
+        {
+            std::lock_guard<std::recursive_mutex> lock(get_curses_mutex());
+            if (screen) {
+                set_term(screen);
+                endwin();
+                delscreen(screen);
+            } else if (inline_mode && initialized) {
+                // Leave the cursor on a fresh line below everything drawn
+                if (sgr_set) out_buf += "\x1b[0m";
+                if (cursor_hidden) out_buf += "\x1b[?25h";
+                bool below = row < rows_used || !line_start;
+                out_buf.append(rows_used - row, '\n');
+                if (below) out_buf += '\n';
+                flush();
+                if (raw_input) tcsetattr(in_fd, TCSANOW, &saved_termios);
+            }
+        }
+        // Only descriptors we duplicated ourselves are closed
+        if (out_file && out_file != stdout) fclose(out_file);
+        if (in_file && in_file != stdin) fclose(in_file);
+#endif
+    }
+
+    // Prevent copying
+    Console(const Console&) = delete;
+    Console& operator=(const Console&) = delete;
+
+    // True if the terminal was opened successfully
+    bool is_open() const { return initialized; }
+
+    const ConsoleStats& stats() const { return stats_; }
+
+    // Pick up a change of terminal size. Returns true if the size differs
+    // from the previous call; the first call only records it. After a change
+    // the next present() redraws the whole frame.
+    bool check_resize() {
+        if (!initialized) return false;
+        int cols, rows;
+#ifdef _WIN32
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return false;
+        cols = csbi.srWindow.Right - csbi.srWindow.Left + 1;
+        rows = csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+#else
+        struct winsize ws;
+        if (ioctl(fileno(out_file), TIOCGWINSZ, &ws) != 0 || ws.ws_col == 0) return false;
+        cols = ws.ws_col;
+        rows = ws.ws_row;
+        if (!inline_mode) {
+            // Bring ncurses up to date without waiting for a KEY_RESIZE read
+            std::unique_lock<std::recursive_mutex> lock = select();
+            int width = 0, height = 0;
+            getmaxyx(win, height, width);
+            if (width != cols || height != rows) resize_term(rows, cols);
+        }
+#endif
+        bool first = known_cols < 0;
+        if (cols == known_cols && rows == known_rows) return false;
+        known_cols = cols;
+        known_rows = rows;
+        if (first) return false;
+        front_valid = false;
+        return true;
+    }
+
+#ifdef _WIN32
+    // Input handle, for waiting on input alongside other events. kbhit()
+    // drops the records that signal it without being key presses.
+    HANDLE input_handle() const { return hInput; }
+#else
+    // Input descriptor, for waiting on input alongside other events
+    int input_fd() const { return in_fd; }
+#endif
+
+    // Colours this terminal can show
+    ColourDepth colour_depth() const { return depth; }
+
+    // Bytes used by this console's screen model (front buffer and row hashes)
+    size_t memory_usage() const {
+        return front.memory_usage() + front_hashes.capacity() * sizeof(uint64_t);
+    }
+
+    // Move cursor to position (0,0 is top-left)
+    void gotoxy(int x, int y) {
+        if (!initialized) return;
+#ifdef _WIN32
+        COORD coord;
+        coord.X = x;
+        coord.Y = y;
+        SetConsoleCursorPosition(hConsole, coord);
+#else
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            move_to(x, y);
+            flush();
+            return;
+        }
+        wmove(win, y, x);
+        wrefresh(win);
+#endif
+    }
+
+    // Clear screen
+    void clrscr() {
+        if (!initialized) return;
+        front_valid = false;
+#ifdef _WIN32
+        if (hConsole == INVALID_HANDLE_VALUE) return;
+
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return;
+
+        DWORD cellCount = csbi.dwSize.X * csbi.dwSize.Y;
+        DWORD count;
+        COORD homeCoord = {0, 0};
+
+        FillConsoleOutputCharacter(hConsole, ' ', cellCount, homeCoord, &count);
+        FillConsoleOutputAttribute(hConsole, csbi.wAttributes, cellCount, homeCoord, &count);
+        SetConsoleCursorPosition(hConsole, homeCoord);
+#else
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            // Clears from the starting line down, leaving earlier output alone
+            move_to(0, 0);
+            out_buf += "\x1b[J";
+            rows_used = 0;
+            flush();
+            return;
+        }
+        wclear(win);
+        wrefresh(win);
+        pairs.clear_uses();
+        std::fill(cell_pairs.begin(), cell_pairs.end(), 0);
+#endif
+    }
+
+    // Set text colour
+    void textcolour(ColourSpec c) {
+        if (!initialized) return;
+        fg = c;
+#ifdef _WIN32
+        if (hConsole == INVALID_HANDLE_VALUE) return;
+        if (vt && c.kind() != ColourSpec::BASIC) {
+            write_sgr(Style{fg, bg, ATTR_NONE});
+            return;
+        }
+
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return;
+
+        WORD attrs = (csbi.wAttributes & 0xF0) | static_cast<WORD>(to_basic(c));
+        SetConsoleTextAttribute(hConsole, attrs);
+#else
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            sgr_set |= 1;
+            append_colours();
+            flush();
+            return;
+        }
+        colour_active = true;
+        apply_colour();
+#endif
+    }
+
+    // Set background colour
+    void textbackground(ColourSpec c) {
+        if (!initialized) return;
+        bg = c;
+#ifdef _WIN32
+        if (hConsole == INVALID_HANDLE_VALUE) return;
+        if (vt && c.kind() != ColourSpec::BASIC) {
+            write_sgr(Style{fg, bg, ATTR_NONE});
+            return;
+        }
+
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return;
+
+        WORD attrs = (csbi.wAttributes & 0x0F) | (static_cast<WORD>(to_basic(c)) << 4);
+        SetConsoleTextAttribute(hConsole, attrs);
+#else
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            sgr_set |= 2;
+            append_colours();
+            flush();
+            return;
+        }
+        colour_active = true;
+        apply_colour();
+#endif
+    }
+
+    // Set both foreground and background colours
+    void textattr(ColourSpec f, ColourSpec b) {
+        if (!initialized) return;
+        fg = f;
+        bg = b;
+#ifdef _WIN32
+        if (hConsole == INVALID_HANDLE_VALUE) return;
+        if (vt && (f.kind() != ColourSpec::BASIC || b.kind() != ColourSpec::BASIC)) {
+            write_sgr(Style{fg, bg, ATTR_NONE});
+            return;
+        }
+
+        WORD attrs = static_cast<WORD>(to_basic(f)) | (static_cast<WORD>(to_basic(b)) << 4);
+        SetConsoleTextAttribute(hConsole, attrs);
+#else
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            sgr_set = 3;
+            append_colours();
+            flush();
+            return;
+        }
+        colour_active = true;
+        apply_colour();
+#endif
+    }
+
+    // Reset text attributes to default
+    void resetattr() {
+        if (!initialized) return;
+        fg = Colour::WHITE;
+        bg = Colour::BLACK;
+#ifdef _WIN32
+        if (vt) {
+            DWORD written;
+            WriteConsoleA(hConsole, "\x1b[0m", 4, &written, NULL);
+        }
+        SetConsoleTextAttribute(hConsole, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+#else
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            sgr_set = 0;
+            out_buf += "\x1b[0m";
+            flush();
+            return;
+        }
+        colour_active = false;
+        wattrset(win, A_NORMAL);
+        wrefresh(win);
+#endif
+    }
+
+    // Print character at current position
+    void putch(char c) {
+        if (!initialized) return;
+#ifdef _WIN32
+        DWORD written;
+        WriteConsoleA(hConsole, &c, 1, &written, NULL);
+#else
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            emit(&c, 1);
+            flush();
+            return;
+        }
+        apply_colour();
+        waddch(win, static_cast<unsigned char>(c));
+        wrefresh(win);
+#endif
+    }
+
+    void putch(int x, int y, char c) { gotoxy(x, y); putch(c); }
+    void putch(int x, int y, char c, ColourSpec f, ColourSpec b) { gotoxy(x, y); textattr(f, b); putch(c); }
+    void putch(int x, int y, char c, ColourSpec f) { gotoxy(x, y); textcolour(f); putch(c); }
+
+    // Print wide character at current position
+    void putwch(wchar_t wc) {
+        if (!initialized) return;
+#ifdef _WIN32
+        DWORD written;
+        WriteConsoleW(hConsole, &wc, 1, &written, NULL);
+#else
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            std::string text;
+            encode_utf8(static_cast<char32_t>(wc), text);
+            emit(text.data(), text.size());
+            flush();
+            return;
+        }
+        apply_colour();
+        waddnwstr(win, &wc, 1);
+        wrefresh(win);
+#endif
+    }
+
+    void putwch(int x, int y, wchar_t wc) { gotoxy(x, y); putwch(wc); }
+    void putwch(int x, int y, wchar_t wc, ColourSpec f) { gotoxy(x, y); textcolour(f); putwch(wc); }
+    void putwch(int x, int y, wchar_t wc, ColourSpec f, ColourSpec b) { gotoxy(x, y); textattr(f, b); putwch(wc); }
+
+    // Print wide string (Unicode) at current position
+    void wputs(const wchar_t* wstr) {
+        if (!initialized) return;
+#ifdef _WIN32
+        DWORD written;
+        WriteConsoleW(hConsole, wstr, static_cast<DWORD>(wcslen(wstr)), &written, NULL);
+#else
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            std::string text;
+            for (const wchar_t* p = wstr; *p; p++) encode_utf8(static_cast<char32_t>(*p), text);
+            emit(text.data(), text.size());
+            flush();
+            return;
+        }
+        apply_colour();
+        waddnwstr(win, wstr, static_cast<int>(wcslen(wstr)));
+        wrefresh(win);
+#endif
+    }
+
+    void wputs(int x, int y, const wchar_t* wstr) { gotoxy(x, y); wputs(wstr); }
+    void wputs(int x, int y, ColourSpec f, const wchar_t* wstr) { gotoxy(x, y); textcolour(f); wputs(wstr); }
+    void wputs(int x, int y, ColourSpec f, ColourSpec b, const wchar_t* wstr) { gotoxy(x, y); textattr(f, b); wputs(wstr); }
+
+    // Print UTF-8 string
+    void print_utf8(const char* utf8_str) {
+        if (!initialized) return;
+#ifdef _WIN32
+        // Windows: convert UTF-8 to wide chars and print
+        int wlen = MultiByteToWideChar(CP_UTF8, 0, utf8_str, -1, NULL, 0);
+        if (wlen > 0) {
+            std::unique_ptr<wchar_t[]> wstr(new wchar_t[wlen]);
+            MultiByteToWideChar(CP_UTF8, 0, utf8_str, -1, wstr.get(), wlen);
+            DWORD written;
+            WriteConsoleW(hConsole, wstr.get(), static_cast<DWORD>(wcslen(wstr.get())), &written, NULL);
+        }
+#else
+        // Linux: ncurses with UTF-8 locale handles this directly
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            emit(utf8_str, strlen(utf8_str));
+            flush();
+            return;
+        }
+        apply_colour();
+        waddstr(win, utf8_str);
+        wrefresh(win);
+#endif
+    }
+
+    void print_utf8(ColourSpec f, const char* utf8_str) { textcolour(f); print_utf8(utf8_str); }
+    void print_utf8(int x, int y, const char* utf8_str) { gotoxy(x, y); print_utf8(utf8_str); }
+    void print_utf8(int x, int y, ColourSpec f, const char* utf8_str) { gotoxy(x, y); textcolour(f); print_utf8(utf8_str); }
+    void print_utf8(int x, int y, ColourSpec f, ColourSpec b, const char* utf8_str) { gotoxy(x, y); textattr(f, b); print_utf8(utf8_str); }
+
+    // Draw prepared text: no decoding or conversion, and one attribute
+    // change per style run
+    void draw(int x, int y, const PreparedText& text) {
+        if (!initialized) return;
+#ifdef _WIN32
+        if (vt) {
+            char pos[24];
+            snprintf(pos, sizeof(pos), "\x1b[%d;%dH", y + 1, x + 1);
+            std::string out = pos;
+            out += text.bytes(depth);
+            append_sgr(out, Style{fg, bg, ATTR_NONE}, depth);
+            DWORD written;
+            WriteConsoleA(hConsole, out.data(), static_cast<DWORD>(out.size()), &written, NULL);
+            return;
+        }
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return;
+        COORD coord = { static_cast<SHORT>(x), static_cast<SHORT>(y) };
+        SetConsoleCursorPosition(hConsole, coord);
+        for (size_t i = 0; i < text.runs().size(); i++) {
+            const PreparedText::Run& run = text.runs()[i];
+            const Style& style = style_table()[run.style];
+            WORD attrs = static_cast<WORD>(to_basic(style.fg)) | (static_cast<WORD>(to_basic(style.bg)) << 4);
+            if (style.attrs & ATTR_UNDERLINE) attrs |= COMMON_LVB_UNDERSCORE;
+            if (style.attrs & ATTR_REVERSE) attrs |= COMMON_LVB_REVERSE_VIDEO;
+            SetConsoleTextAttribute(hConsole, attrs);
+            DWORD written;
+            WriteConsoleW(hConsole, text.wide().data() + run.offset, static_cast<DWORD>(run.length), &written, NULL);
+        }
+        SetConsoleTextAttribute(hConsole, csbi.wAttributes);
+#else
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            move_to(x, y);
+            out_buf += text.bytes(depth, true);
+            append_colours();
+            flush();
+            return;
+        }
+        wmove(win, y, x);
+        for (size_t i = 0; i < text.runs().size(); i++) {
+            const PreparedText::Run& run = text.runs()[i];
+            const Style& style = style_table()[run.style];
+            bool bold = (style.attrs & ATTR_BOLD) != 0;
+            int pair = colour_pair(style.fg, style.bg, bold);
+            attr_t attrs = bold ? A_BOLD : A_NORMAL;
+            if (style.attrs & ATTR_UNDERLINE) attrs |= A_UNDERLINE;
+            if (style.attrs & ATTR_REVERSE) attrs |= A_REVERSE;
+#if defined(NCURSES_EXT_COLORS)
+            wattr_set(win, attrs, static_cast<short>(pair), &pair);
+#else
+            wattr_set(win, attrs, static_cast<short>(pair), nullptr);
+#endif
+            waddnwstr(win, text.wide().data() + run.offset, static_cast<int>(run.length));
+        }
+        wattrset(win, A_NORMAL);
+        apply_colour();
+        wrefresh(win);
+#endif
+    }
+
+    void draw(int x, int y, const PreparedBox& box) { draw_box(*this, x, y, box); }
+
+    // Get a character
+    int getchar() {
+        if (!initialized) return -1;
+#ifdef _WIN32
+        return read_byte(false);
+#else
+        if (inline_mode) return read_key_inline(false, nullptr);
+        return read_key(false, nullptr);
+#endif
+    }
+
+    // Get a character with echo
+    int getcharecho() {
+        if (!initialized) return -1;
+#ifdef _WIN32
+        return read_byte(true);
+#else
+        if (inline_mode) return read_key_inline(true, nullptr);
+        return read_key(true, nullptr);
+#endif
+    }
+
+    // Get a wide character (Unicode input)
+    wint_t getwchar() {
+        if (!initialized) return WEOF;
+#ifdef _WIN32
+        return read_wide(false);
+#else
+        wint_t wc = WEOF;
+        if (inline_mode) read_key_inline(false, &wc);
+        else read_key(false, &wc);
+        return wc;
+#endif
+    }
+
+    // Read a key, telling key codes apart from characters with the same value
+    Key getkey() {
+        Key key = { WEOF, false };
+        if (!initialized) return key;
+#ifdef _WIN32
+        InputKey input;
+        if (read_input(input, true)) key = input.key;
+#else
+        int result = inline_mode ? read_key_inline(false, &key.code) : read_key(false, &key.code);
+        key.special = result == KEY_CODE_YES;
+#endif
+        return key;
+    }
+
+    // Get a wide character with echo
+    wint_t getwcharecho() {
+        if (!initialized) return WEOF;
+#ifdef _WIN32
+        return read_wide(true);
+#else
+        wint_t wc = WEOF;
+        if (inline_mode) read_key_inline(true, &wc);
+        else read_key(true, &wc);
+        return wc;
+#endif
+    }
+
+    // Check if key has been pressed
+    bool kbhit() {
+        if (!initialized) return false;
+#ifdef _WIN32
+        if (!keys_read.empty() || !bytes_pending.empty() || !wide_pending.empty()) return true;
+        InputKey input;
+        if (!read_input(input, false)) return false;
+        keys_read.push_back(input);
+        return true;
+#else
+        if (inline_mode) {
+            if (!pending.empty()) return true;
+            start_input();
+            struct pollfd pfd = { in_fd, POLLIN, 0 };
+            return poll(&pfd, 1, 0) > 0;
+        }
+        std::unique_lock<std::recursive_mutex> lock = select();
+        nodelay(win, TRUE);
+        int ch = wgetch(win);
+        nodelay(win, FALSE);
+
+        if (ch != ERR) {
+            ungetch(ch);
+            return true;
+        }
+        return false;
+#endif
     }
+
+    // Printf at current position
+    void vprintf(const char* format, va_list args) {
+        if (!initialized) return;
+#ifdef _WIN32
+        char buffer[4096];
+        vsnprintf(buffer, sizeof(buffer), format, args);
+        DWORD written;
+        WriteConsoleA(hConsole, buffer, static_cast<DWORD>(strlen(buffer)), &written, NULL);
 #else
-    #define _XOPEN_SOURCE_EXTENDED 1
-    #include <ncursesw/ncurses.h>
-    #include <unistd.h>
-    #include <termios.h>
-    #include <locale.h>
-    #include <wchar.h>
+        char buffer[4096];
+        vsnprintf(buffer, sizeof(buffer), format, args);
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            emit(buffer, strlen(buffer));
+            flush();
+            return;
+        }
+        apply_colour();
+        waddstr(win, buffer);
+        wrefresh(win);
 #endif
+    }
 
-namespace conio {
+    void printf(const char* format, ...) {
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
 
-// Colour constants
-enum class Colour {
-    BLACK = 0,
-    BLUE = 1,
-    GREEN = 2,
-    CYAN = 3,
-    RED = 4,
-    MAGENTA = 5,
-    YELLOW = 6,
-    WHITE = 7,
-    BRIGHT_BLACK = 8,
-    BRIGHT_BLUE = 9,
-    BRIGHT_GREEN = 10,
-    BRIGHT_CYAN = 11,
-    BRIGHT_RED = 12,
-    BRIGHT_MAGENTA = 13,
-    BRIGHT_YELLOW = 14,
-    BRIGHT_WHITE = 15
-};
+    void printf(int x, int y, const char* format, ...) {
+        gotoxy(x, y);
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
 
-// Global mutex for thread-safe console operations
-inline std::mutex& get_console_mutex() {
-    static std::mutex console_mutex;
-    return console_mutex;
-}
+    void printf(int x, int y, ColourSpec f, ColourSpec b, const char* format, ...) {
+        gotoxy(x, y);
+        textattr(f, b);
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
 
-// RAII wrapper for console initialization
-class Console {
+    void printf(int x, int y, ColourSpec f, const char* format, ...) {
+        gotoxy(x, y);
+        textcolour(f);
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+
+    // Get console width
+    int getwidth() const {
+#ifdef _WIN32
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (hConsole == INVALID_HANDLE_VALUE) return 80; // Default width
+        if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return 80;
+        return csbi.srWindow.Right - csbi.srWindow.Left + 1;
+#else
+        if (!initialized) return 80;
+        if (inline_mode) {
+            struct winsize ws;
+            return ioctl(fileno(out_file), TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
+        }
+        std::unique_lock<std::recursive_mutex> lock = select();
+        int width = 0, height = 0;
+        getmaxyx(win, height, width);
+        (void)height; // height is only needed for getmaxyx macro
+        return width > 0 ? width : 80;
+#endif
+    }
+
+    // Get console height
+    int getheight() const {
+#ifdef _WIN32
+        CONSOLE_SCREEN_BUFFER_INFO csbi;
+        if (hConsole == INVALID_HANDLE_VALUE) return 24; // Default height
+        if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return 24;
+        return csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
+#else
+        if (!initialized) return 24;
+        if (inline_mode) {
+            struct winsize ws;
+            return ioctl(fileno(out_file), TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 ? ws.ws_row : 24;
+        }
+        std::unique_lock<std::recursive_mutex> lock = select();
+        int width = 0, height = 0;
+        getmaxyx(win, height, width);
+        (void)width; // width is only needed for getmaxyx macro
+        return height > 0 ? height : 24;
+#endif
+    }
+
+    // Show/hide cursor
+    void showcursor(bool visible) {
+        if (!initialized) return;
+#ifdef _WIN32
+        CONSOLE_CURSOR_INFO cursorInfo;
+        GetConsoleCursorInfo(hConsole, &cursorInfo);
+        cursorInfo.bVisible = visible;
+        SetConsoleCursorInfo(hConsole, &cursorInfo);
+#else
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (inline_mode) {
+            cursor_hidden = !visible;
+            out_buf += visible ? "\x1b[?25h" : "\x1b[?25l";
+            flush();
+            return;
+        }
+        curs_set(visible ? 1 : 0);
+#endif
+    }
+
+    // Display a canvas. Only cells that differ from the previously presented
+    // frame are sent, so one canvas can be shared by many consoles while each
+    // console pays only for its own diff. Rows whose hash is unchanged are
+    // skipped outright; in the others the changed span is located with
+    // vector compares. Forgets its state after clrscr().
+    void present(const Canvas& frame) {
+        if (!initialized) return;
+        int cols = getwidth();
+        int rows = getheight();
+#ifndef _WIN32
+        // Inline mode only claims as many lines as the frame has
+        if (inline_mode && frame.getheight() < rows) rows = frame.getheight();
+#endif
+        if (front.getwidth() != cols || front.getheight() != rows) {
+            front.resize(cols, rows);
+            front_valid = false;
+        }
+        if (!front_valid || hashed_width != frame.getwidth()) {
+            front_hashes.assign(rows, 0);
+            hashed_width = frame.getwidth();
+        }
+        int w = frame.getwidth() < cols ? frame.getwidth() : cols;
+        int h = frame.getheight() < rows ? frame.getheight() : rows;
+        if (w <= 0) h = 0;
+        stats_.frames_presented++;
+        colours_lost = false;
+
+#ifndef _WIN32
+        std::unique_lock<std::recursive_mutex> lock = select();
+        if (!inline_mode) fit_cell_pairs(cols, rows);
+#else
+        std::vector<CHAR_INFO> span(w > 0 ? w : 1);
+        std::string out; // escape sequences for the whole frame when vt is on
+#endif
+        for (int y = 0; y < h; y++) {
+            uint64_t hash = frame.row_hash(y);
+            if (front_valid && front_hashes[y] == hash) {
+                stats_.rows_skipped++;
+                continue;
+            }
+            front_hashes[y] = hash;
+
+            const Cell* src = frame.row(y);
+            Cell* dst = front.row(y);
+            int first = 0, last = w - 1;
+            if (front_valid) {
+                stats_.cells_compared += w;
+                size_t bytes = w * sizeof(Cell);
+                size_t lo = first_difference(src, dst, bytes);
+                if (lo == bytes) continue;
+                first = static_cast<int>(lo / sizeof(Cell));
+                last = static_cast<int>(last_difference(src, dst, bytes) / sizeof(Cell));
+            }
+            // Never start or end a span half way through a wide glyph
+            if (first > 0 && src[first].glyph == 0) first--;
+            if (last + 1 < w && src[last + 1].glyph == 0) last++;
+
+#ifdef _WIN32
+            if (vt) {
+                // Position once per span and switch styles only where they change
+                char pos[24];
+                snprintf(pos, sizeof(pos), "\x1b[%d;%dH", y + 1, first + 1);
+                out += pos;
+                append_cells(out, src, first, last, depth);
+                stats_.cells_written += last - first + 1;
+                std::copy(src + first, src + last + 1, dst + first);
+                continue;
+            }
+            for (int x = first; x <= last; x++) {
+                const Cell& cell = src[x];
+                const Style& style = style_table()[cell.style];
+                bool tail = cell.glyph == 0 && x > 0;
+                char32_t cp = glyph_base(tail ? src[x - 1].glyph : cell.glyph);
+                span[x - first].Char.UnicodeChar = cp > 0xFFFF ? 0xFFFD : static_cast<WCHAR>(cp);
+                span[x - first].Attributes = static_cast<WORD>(to_basic(style.fg)) |
+                                             (static_cast<WORD>(to_basic(style.bg)) << 4);
+                if (style.attrs & ATTR_UNDERLINE) span[x - first].Attributes |= COMMON_LVB_UNDERSCORE;
+                if (style.attrs & ATTR_REVERSE) span[x - first].Attributes |= COMMON_LVB_REVERSE_VIDEO;
+                if (tail) {
+                    span[x - first].Attributes |= COMMON_LVB_TRAILING_BYTE;
+                } else if (x + 1 < w && src[x + 1].glyph == 0) {
+                    span[x - first].Attributes |= COMMON_LVB_LEADING_BYTE;
+                }
+            }
+            COORD size = { static_cast<SHORT>(last - first + 1), 1 };
+            COORD origin = { 0, 0 };
+            SMALL_RECT region = { static_cast<SHORT>(first), static_cast<SHORT>(y),
+                                  static_cast<SHORT>(last), static_cast<SHORT>(y) };
+            WriteConsoleOutputW(hConsole, span.data(), size, origin, &region);
+            stats_.cells_written += last - first + 1;
+#else
+            if (inline_mode) {
+                move_to(first, y);
+                append_cells(out_buf, src, first, last, depth, true);
+                stats_.cells_written += last - first + 1;
+                std::copy(src + first, src + last + 1, dst + first);
+                continue;
+            }
+            for (int x = first; x <= last; x++) {
+                if (front_valid && src[x] == dst[x]) continue;
+                if (src[x].glyph != 0) {
+                    draw_cell(x, y, src[x]);
+                } else if (x > 0 && src[x - 1].glyph != 0) {
+                    // Changed right half of a wide glyph: redraw the glyph
+                    draw_cell(x - 1, y, src[x - 1]);
+                }
+                stats_.cells_written++;
+            }
+#endif
+            std::copy(src + first, src + last + 1, dst + first);
+        }
+#ifdef _WIN32
+        if (!out.empty()) {
+            out += "\x1b[0m";
+            DWORD written;
+            WriteConsoleA(hConsole, out.data(), static_cast<DWORD>(out.size()), &written, NULL);
+        }
+#else
+        if (inline_mode) {
+            if (!out_buf.empty()) append_colours();
+            flush();
+        } else {
+            wrefresh(win);
+        }
+#endif
+        front_valid = !colours_lost;
+    }
+};
+
+// A few pinned status lines (progress bars, throughput, ...) kept below
+// ordinary scrolling output, without taking over the screen. Lines passed to
+// log() are queued and written above the region in batches; the pinned lines
+// are redrawn only when they change, and at most once per interval, so a busy
+// log stream is not slowed down by the status display. Output held back by the
+// interval is written by a timer thread once the interval is up. When the
+// output is not a terminal the pinned lines are dropped and log lines pass
+// straight through.
+class InlineRegion {
 private:
 #ifdef _WIN32
-    HANDLE hConsole;
-    WORD defaultAttrs;
+    HANDLE out;
 #else
-    bool initialized;
+    int out_fd;
 #endif
+    bool tty;
+    ColourDepth depth;
+    Canvas lines_;
+    std::vector<uint64_t> drawn_hashes; // row hashes as last drawn
+    uint32_t drawn_generation;          // shared_table_generation() they were taken in
+    bool drawn;                         // region is on screen, cursor on its top line
+    std::string logs;                   // queued log lines
+    std::string out_buf;
+    std::chrono::steady_clock::duration interval;
+    std::chrono::steady_clock::time_point last_flush;
+    bool pending;  // output is waiting for the interval to pass
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread timer; // started the first time output is held back
 
-public:
-    Console() {
+    // Queued log output beyond this is written without waiting for the interval
+    static const size_t MAX_QUEUED = 64 * 1024;
+
+    int terminal_width() const {
 #ifdef _WIN32
-        hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
         CONSOLE_SCREEN_BUFFER_INFO csbi;
-        GetConsoleScreenBufferInfo(hConsole, &csbi);
-        defaultAttrs = csbi.wAttributes;
-        // Set UTF-8 code page for Unicode support
-        SetConsoleOutputCP(CP_UTF8);
-        SetConsoleCP(CP_UTF8);
+        if (!GetConsoleScreenBufferInfo(out, &csbi)) return 80;
+        return csbi.srWindow.Right - csbi.srWindow.Left + 1;
 #else
-        // Set locale for UTF-8 support before initializing ncurses
-        setlocale(LC_ALL, "");
-        
-        initscr();
-        start_color();
-        cbreak();
-        noecho();
-        keypad(stdscr, TRUE);
-        curs_set(1);
-        initialized = true;
-        
-        // Initialize colour pairs (foreground, background)
-        // Map our enum order to ncurses COLOR_ constants
-        // Our enum: BLACK(0), BLUE(1), GREEN(2), CYAN(3), RED(4), MAGENTA(5), YELLOW(6), WHITE(7)
-        // ncurses:  BLACK(0), RED(1),  GREEN(2), YELLOW(3), BLUE(4), MAGENTA(5), CYAN(6),  WHITE(7)
-        init_pair(1, COLOR_BLACK, COLOR_BLACK);   // BLACK
-        init_pair(2, COLOR_BLUE, COLOR_BLACK);    // BLUE
-        init_pair(3, COLOR_GREEN, COLOR_BLACK);   // GREEN
-        init_pair(4, COLOR_CYAN, COLOR_BLACK);    // CYAN
-        init_pair(5, COLOR_RED, COLOR_BLACK);     // RED
-        init_pair(6, COLOR_MAGENTA, COLOR_BLACK); // MAGENTA
-        init_pair(7, COLOR_YELLOW, COLOR_BLACK);  // YELLOW
-        init_pair(8, COLOR_WHITE, COLOR_BLACK);   // WHITE
+        struct winsize ws;
+        return ioctl(out_fd, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 ? ws.ws_col : 80;
 #endif
     }
 
-    ~Console() {
+    void write_out() {
+        if (out_buf.empty()) return;
 #ifdef _WIN32
-        SetConsoleTextAttribute(hConsole, defaultAttrs);
+        DWORD written;
+        WriteFile(out, out_buf.data(), static_cast<DWORD>(out_buf.size()), &written, NULL);
 #else
-        if (initialized) {
-            endwin();
+        if (out_fd == STDOUT_FILENO) fflush(stdout);
+        const char* p = out_buf.data();
+        size_t left = out_buf.size();
+        while (left > 0) {
+            ssize_t n = ::write(out_fd, p, left);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            p += n;
+            left -= static_cast<size_t>(n);
         }
 #endif
+        out_buf.clear();
     }
 
-    // Prevent copying
-    Console(const Console&) = delete;
-    Console& operator=(const Console&) = delete;
+    // Write queued log lines and whichever pinned lines changed, in one write.
+    // The cursor is kept on the region's top line between calls.
+    void flush_locked() {
+        last_flush = std::chrono::steady_clock::now();
+        pending = false;
+        if (!tty) {
+            out_buf.swap(logs);
+            write_out();
+            return;
+        }
+        int height = lines_.getheight();
+        // Stay clear of the last column so a full row never wraps
+        int width = std::min(lines_.getwidth(), terminal_width() - 1);
+        // Indices freed since the last flush may be reused with another
+        // meaning, so old hashes cannot be trusted across a reclaim
+        uint32_t generation = shared_table_generation().load();
+        bool full = !drawn || !logs.empty() || generation != drawn_generation;
+        drawn_generation = generation;
+        if (!logs.empty()) {
+            // Erase the region, print the log lines where it was and redraw
+            // the whole region below them
+            if (drawn) out_buf += "\r\x1b[J";
+            out_buf += logs;
+            logs.clear();
+        }
+
+        char seq[24];
+        int at = 0; // cursor row within the region
+        for (int y = 0; y < height; y++) {
+            uint64_t hash = lines_.row_hash(y);
+            if (!full && drawn_hashes[y] == hash) continue;
+            drawn_hashes[y] = hash;
+            if (full) {
+                if (y > 0) out_buf += '\n';
+            } else if (y > at) {
+                snprintf(seq, sizeof(seq), "\x1b[%dB", y - at);
+                out_buf += seq;
+            }
+            at = y;
+            out_buf += '\r';
+            const Cell* row = lines_.row(y);
+            int last = width - 1;
+            while (last >= 0 && row[last].glyph == ' ' && row[last].style == 0) last--;
+            append_cells(out_buf, row, 0, last, depth, true);
+            out_buf += "\x1b[0m\x1b[K";
+        }
+        if (at > 0) {
+            snprintf(seq, sizeof(seq), "\x1b[%dA\r", at);
+            out_buf += seq;
+        }
+        drawn = true;
+        write_out();
+    }
+
+    void update_locked() {
+        if (std::chrono::steady_clock::now() - last_flush >= interval) {
+            flush_locked();
+            return;
+        }
+        if (!pending) {
+            pending = true;
+            if (!timer.joinable()) timer = std::thread(&InlineRegion::run_timer, this);
+            wake.notify_one();
+        }
+    }
+
+    // Timer thread: write held-back output when its interval is up
+    void run_timer() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            if (!pending) {
+                wake.wait(lock);
+            } else if (std::chrono::steady_clock::now() >= last_flush + interval) {
+                flush_locked();
+            } else {
+                wake.wait_until(lock, last_flush + interval);
+            }
+        }
+    }
+
+public:
+    // Pin `lines` status lines below the output. Redraws happen at most once
+    // per interval_ms.
+#ifdef _WIN32
+    explicit InlineRegion(int lines, HANDLE output = GetStdHandle(STD_OUTPUT_HANDLE), int interval_ms = 50)
+        : out(output), tty(false), depth(ColourDepth::TRUECOLOUR), lines_(0, 0), drawn_generation(0), drawn(false),
+          interval(std::chrono::milliseconds(interval_ms)), last_flush(), pending(false), stopping(false) {
+        DWORD mode;
+        tty = GetConsoleMode(out, &mode) && SetConsoleMode(out, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+        if (tty) SetConsoleOutputCP(CP_UTF8);
+#else
+    explicit InlineRegion(int lines, int output_fd = STDOUT_FILENO, int interval_ms = 50)
+        : out_fd(output_fd), tty(isatty(output_fd) != 0), depth(env_colour_depth(nullptr)), lines_(0, 0),
+          drawn_generation(0), drawn(false), interval(std::chrono::milliseconds(interval_ms)), last_flush(),
+          pending(false), stopping(false) {
+#endif
+        if (tty) {
+            lines_.resize(terminal_width() - 1, lines);
+            drawn_hashes.assign(lines > 0 ? lines : 0, 0);
+        }
+    }
+
+    // Writes anything still queued and leaves the cursor below the region
+    ~InlineRegion() {
+        if (timer.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_one();
+            timer.join();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        flush_locked();
+        if (drawn && lines_.getheight() > 0) {
+            int below = lines_.getheight() - 1;
+            if (below > 0) {
+                char seq[24];
+                snprintf(seq, sizeof(seq), "\x1b[%dB", below);
+                out_buf += seq;
+            }
+            out_buf += "\r\n";
+            write_out();
+        }
+    }
+
+    InlineRegion(const InlineRegion&) = delete;
+    InlineRegion& operator=(const InlineRegion&) = delete;
+
+    // Print a line above the region; a newline is added if missing
+    void log(const char* utf8_line) {
+        std::lock_guard<std::mutex> lock(mutex);
+        logs += utf8_line;
+        if (logs.empty() || logs[logs.size() - 1] != '\n') logs += '\n';
+        if (logs.size() >= MAX_QUEUED) flush_locked();
+        else update_locked();
+    }
+
+    void logf(const char* format, ...) {
+        char buffer[4096];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(buffer, sizeof(buffer), format, args);
+        va_end(args);
+        log(buffer);
+    }
+
+    // Replace pinned line `index` with text
+    void set_line(int index, const char* utf8_str) { set_line(index, Colour::WHITE, utf8_str); }
+
+    void set_line(int index, ColourSpec fg, const char* utf8_str) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index < 0 || index >= lines_.getheight()) return;
+        std::vector<Cell> blank(lines_.getwidth(), Cell{' ', 0});
+        lines_.put_cells(0, index, blank.data(), static_cast<int>(blank.size()));
+        lines_.resetattr();
+        lines_.print_utf8(0, index, fg, utf8_str);
+        update_locked();
+    }
+
+    // Draw on the pinned lines with the full canvas API (colours, progress
+    // bars, prepared text): f is called with the lines' Canvas while the
+    // region is locked, so the timer thread never writes a half-drawn frame.
+    // The region is then redrawn as by update(). Keep no reference to the
+    // canvas beyond the call.
+    template <typename F>
+    void draw(F f) {
+        std::lock_guard<std::mutex> lock(mutex);
+        f(lines_);
+        update_locked();
+    }
+
+    // Redraw if anything changed: now if the interval has passed, otherwise
+    // as soon as it has
+    void update() {
+        std::lock_guard<std::mutex> lock(mutex);
+        update_locked();
+    }
+
+    // Write queued log lines and changed pinned lines now
+    void flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        flush_locked();
+    }
+
+    int height() const { return lines_.getheight(); }
 };
 
 // Global console instance - users should create one at the start of their program
@@ -132,9 +3249,9 @@ inline bool is_initialized() {
 }
 
 // Initialize console (must be called before using other functions)
-inline void init() {
+inline void init(const InitConfig& config = InitConfig()) {
     std::lock_guard<std::mutex> lock(get_console_mutex());
-    get_console().reset(new Console());
+    get_console().reset(new Console(config));
 }
 
 // Cleanup console (automatically called on exit if using init())
@@ -143,345 +3260,224 @@ inline void cleanup() {
     get_console().reset();
 }
 
+// Canvas the calling thread's drawing is redirected to, if any
+inline Canvas*& recording_canvas() {
+    static thread_local Canvas* canvas = nullptr;
+    return canvas;
+}
+
+// Redirect the free drawing functions (gotoxy, putch, printf, print_utf8,
+// colours, ...) on the calling thread into a canvas for the scope's lifetime.
+// Worker threads can each build a pane this way without touching the console
+// lock; the panes are merged afterwards with a Compositor.
+class DrawScope {
+private:
+    Canvas* previous;
+
+public:
+    explicit DrawScope(Canvas& canvas) : previous(recording_canvas()) {
+        recording_canvas() = &canvas;
+    }
+    ~DrawScope() { recording_canvas() = previous; }
+
+    DrawScope(const DrawScope&) = delete;
+    DrawScope& operator=(const DrawScope&) = delete;
+};
+
+// The instance the free functions below act on; initialised on first use
+inline Console& default_console() {
+    std::lock_guard<std::mutex> lock(get_console_mutex());
+    std::unique_ptr<Console>& console = get_console();
+    if (!console) console.reset(new Console());
+    return *console;
+}
+
 // Move cursor to position (0,0 is top-left)
 inline void gotoxy(int x, int y) {
-#ifdef _WIN32
-    COORD coord;
-    coord.X = x;
-    coord.Y = y;
-    SetConsoleCursorPosition(GetStdHandle(STD_OUTPUT_HANDLE), coord);
-#else
-    move(y, x);
-    refresh();
-#endif
+    if (Canvas* canvas = recording_canvas()) canvas->gotoxy(x, y);
+    else default_console().gotoxy(x, y);
 }
 
 // Clear screen
 inline void clrscr() {
-#ifdef _WIN32
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) return;
-    
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return;
-    
-    DWORD cellCount = csbi.dwSize.X * csbi.dwSize.Y;
-    DWORD count;
-    COORD homeCoord = {0, 0};
-
-    FillConsoleOutputCharacter(hConsole, ' ', cellCount, homeCoord, &count);
-    FillConsoleOutputAttribute(hConsole, csbi.wAttributes, cellCount, homeCoord, &count);
-    SetConsoleCursorPosition(hConsole, homeCoord);
-#else
-    clear();
-    refresh();
-#endif
+    if (Canvas* canvas = recording_canvas()) canvas->clrscr();
+    else default_console().clrscr();
 }
 
 // Set text colour
-inline void textcolour(Colour fg) {
-#ifdef _WIN32
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) return;
-    
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return;
-    
-    WORD attrs = (csbi.wAttributes & 0xF0) | static_cast<WORD>(fg);
-    SetConsoleTextAttribute(hConsole, attrs);
-#else
-    int colour_val = static_cast<int>(fg);
-    bool is_bright = (colour_val >= 8);
-    int base_colour = is_bright ? (colour_val - 8) : colour_val;
-    
-    attron(COLOR_PAIR(base_colour + 1));
-    if (is_bright) {
-        attron(A_BOLD);
-    } else {
-        attroff(A_BOLD);
-    }
-    refresh();
-#endif
+inline void textcolour(ColourSpec fg) {
+    if (Canvas* canvas = recording_canvas()) canvas->textcolour(fg);
+    else default_console().textcolour(fg);
 }
 
 // Set background colour
-inline void textbackground(Colour bg) {
-#ifdef _WIN32
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) return;
-    
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return;
-    
-    WORD attrs = (csbi.wAttributes & 0x0F) | (static_cast<WORD>(bg) << 4);
-    SetConsoleTextAttribute(hConsole, attrs);
-#else
-    int bg_val = static_cast<int>(bg) % 8;
-    // Initialize a colour pair with current foreground (WHITE) and specified background
-    init_pair(64, COLOR_WHITE, bg_val);
-    attron(COLOR_PAIR(64));
-    refresh();
-#endif
+inline void textbackground(ColourSpec bg) {
+    if (Canvas* canvas = recording_canvas()) canvas->textbackground(bg);
+    else default_console().textbackground(bg);
 }
 
 // Set both foreground and background colours
-inline void textattr(Colour fg, Colour bg) {
-#ifdef _WIN32
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) return;
-    
-    WORD attrs = static_cast<WORD>(fg) | (static_cast<WORD>(bg) << 4);
-    SetConsoleTextAttribute(hConsole, attrs);
-#else
-    int fg_val = static_cast<int>(fg) % 8;
-    int bg_val = static_cast<int>(bg) % 8;
-    // Use a pair number that safely fits within ncurses limits (1-255)
-    // Formula: pair_num = 1 + bg_val * 8 + fg_val (ensures 1 <= pair_num <= 64)
-    int pair_num = 1 + bg_val * 8 + fg_val;
-    
-    if (pair_num < 256) {
-        init_pair(pair_num, fg_val, bg_val);
-        attron(COLOR_PAIR(pair_num));
-    }
-    
-    if (static_cast<int>(fg) >= 8) {
-        attron(A_BOLD);
-    }
-    refresh();
-#endif
+inline void textattr(ColourSpec fg, ColourSpec bg) {
+    if (Canvas* canvas = recording_canvas()) canvas->textattr(fg, bg);
+    else default_console().textattr(fg, bg);
 }
 
 // Reset text attributes to default
 inline void resetattr() {
-#ifdef _WIN32
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    SetConsoleTextAttribute(hConsole, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
-#else
-    attrset(A_NORMAL);
-    refresh();
-#endif
+    if (Canvas* canvas = recording_canvas()) canvas->resetattr();
+    else default_console().resetattr();
 }
 
 // Print character at current position
 inline void putch(char c) {
-#ifdef _WIN32
-    _putch(c);
-#else
-    addch(c);
-    refresh();
-#endif
+    if (Canvas* canvas = recording_canvas()) canvas->putch(c);
+    else default_console().putch(c);
 }
 
 // Print character at specified position
 inline void putch(int x, int y, char c) {
-    gotoxy(x, y);
-    putch(c);
+    if (Canvas* canvas = recording_canvas()) canvas->putch(x, y, c);
+    else default_console().putch(x, y, c);
 }
 
 // Print character at specified position with colour
-inline void putch(int x, int y, char c, Colour fg, Colour bg) {
-    gotoxy(x, y);
-    textattr(fg, bg);
-    putch(c);
+inline void putch(int x, int y, char c, ColourSpec fg, ColourSpec bg) {
+    if (Canvas* canvas = recording_canvas()) canvas->putch(x, y, c, fg, bg);
+    else default_console().putch(x, y, c, fg, bg);
 }
 
 // Print character at specified position with foreground colour
-inline void putch(int x, int y, char c, Colour fg) {
-    gotoxy(x, y);
-    textcolour(fg);
-    putch(c);
+inline void putch(int x, int y, char c, ColourSpec fg) {
+    if (Canvas* canvas = recording_canvas()) canvas->putch(x, y, c, fg);
+    else default_console().putch(x, y, c, fg);
 }
 
 // Wide character (Unicode) support
 
 // Print wide character at current position
 inline void putwch(wchar_t wc) {
-#ifdef _WIN32
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    DWORD written;
-    WriteConsoleW(hConsole, &wc, 1, &written, NULL);
-#else
-    addnwstr(&wc, 1);
-    refresh();
-#endif
+    if (Canvas* canvas = recording_canvas()) canvas->putwch(wc);
+    else default_console().putwch(wc);
 }
 
 // Print wide character at specified position
 inline void putwch(int x, int y, wchar_t wc) {
-    gotoxy(x, y);
-    putwch(wc);
+    if (Canvas* canvas = recording_canvas()) canvas->putwch(x, y, wc);
+    else default_console().putwch(x, y, wc);
 }
 
 // Print wide character at specified position with foreground colour
-inline void putwch(int x, int y, wchar_t wc, Colour fg) {
-    gotoxy(x, y);
-    textcolour(fg);
-    putwch(wc);
+inline void putwch(int x, int y, wchar_t wc, ColourSpec fg) {
+    if (Canvas* canvas = recording_canvas()) canvas->putwch(x, y, wc, fg);
+    else default_console().putwch(x, y, wc, fg);
 }
 
 // Print wide character at specified position with colour
-inline void putwch(int x, int y, wchar_t wc, Colour fg, Colour bg) {
-    gotoxy(x, y);
-    textattr(fg, bg);
-    putwch(wc);
+inline void putwch(int x, int y, wchar_t wc, ColourSpec fg, ColourSpec bg) {
+    if (Canvas* canvas = recording_canvas()) canvas->putwch(x, y, wc, fg, bg);
+    else default_console().putwch(x, y, wc, fg, bg);
 }
 
 // Print wide string (Unicode) at current position
 inline void wputs(const wchar_t* wstr) {
-#ifdef _WIN32
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    DWORD written;
-    WriteConsoleW(hConsole, wstr, static_cast<DWORD>(wcslen(wstr)), &written, NULL);
-#else
-    addnwstr(wstr, wcslen(wstr));
-    refresh();
-#endif
+    if (Canvas* canvas = recording_canvas()) canvas->wputs(wstr);
+    else default_console().wputs(wstr);
 }
 
 // Print wide string at specified position
 inline void wputs(int x, int y, const wchar_t* wstr) {
-    gotoxy(x, y);
-    wputs(wstr);
+    if (Canvas* canvas = recording_canvas()) canvas->wputs(x, y, wstr);
+    else default_console().wputs(x, y, wstr);
 }
 
 // Print wide string at specified position with foreground colour
-inline void wputs(int x, int y, Colour fg, const wchar_t* wstr) {
-    gotoxy(x, y);
-    textcolour(fg);
-    wputs(wstr);
+inline void wputs(int x, int y, ColourSpec fg, const wchar_t* wstr) {
+    if (Canvas* canvas = recording_canvas()) canvas->wputs(x, y, fg, wstr);
+    else default_console().wputs(x, y, fg, wstr);
 }
 
 // Print wide string at specified position with colour
-inline void wputs(int x, int y, Colour fg, Colour bg, const wchar_t* wstr) {
-    gotoxy(x, y);
-    textattr(fg, bg);
-    wputs(wstr);
+inline void wputs(int x, int y, ColourSpec fg, ColourSpec bg, const wchar_t* wstr) {
+    if (Canvas* canvas = recording_canvas()) canvas->wputs(x, y, fg, bg, wstr);
+    else default_console().wputs(x, y, fg, bg, wstr);
 }
 
 // Print UTF-8 string (for convenience)
 inline void print_utf8(const char* utf8_str) {
-#ifdef _WIN32
-    // Windows: convert UTF-8 to wide chars and print
-    int wlen = MultiByteToWideChar(CP_UTF8, 0, utf8_str, -1, NULL, 0);
-    if (wlen > 0) {
-        std::unique_ptr<wchar_t[]> wstr(new wchar_t[wlen]);
-        MultiByteToWideChar(CP_UTF8, 0, utf8_str, -1, wstr.get(), wlen);
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        DWORD written;
-        WriteConsoleW(hConsole, wstr.get(), static_cast<DWORD>(wcslen(wstr.get())), &written, NULL);
-    }
-#else
-    // Linux: ncurses with UTF-8 locale handles this directly
-    addstr(utf8_str);
-    refresh();
-#endif
+    if (Canvas* canvas = recording_canvas()) canvas->print_utf8(utf8_str);
+    else default_console().print_utf8(utf8_str);
 }
 
 // Print UTF-8 string with foreground colour (no position)
-inline void print_utf8(Colour fg, const char* utf8_str) {
-    textcolour(fg);
-    print_utf8(utf8_str);
+inline void print_utf8(ColourSpec fg, const char* utf8_str) {
+    if (Canvas* canvas = recording_canvas()) canvas->print_utf8(fg, utf8_str);
+    else default_console().print_utf8(fg, utf8_str);
 }
 
 // Print UTF-8 string at specified position
 inline void print_utf8(int x, int y, const char* utf8_str) {
-    gotoxy(x, y);
-    print_utf8(utf8_str);
+    if (Canvas* canvas = recording_canvas()) canvas->print_utf8(x, y, utf8_str);
+    else default_console().print_utf8(x, y, utf8_str);
 }
 
 // Print UTF-8 string at specified position with foreground colour
-inline void print_utf8(int x, int y, Colour fg, const char* utf8_str) {
-    gotoxy(x, y);
-    textcolour(fg);
-    print_utf8(utf8_str);
+inline void print_utf8(int x, int y, ColourSpec fg, const char* utf8_str) {
+    if (Canvas* canvas = recording_canvas()) canvas->print_utf8(x, y, fg, utf8_str);
+    else default_console().print_utf8(x, y, fg, utf8_str);
 }
 
 // Print UTF-8 string at specified position with colour
-inline void print_utf8(int x, int y, Colour fg, Colour bg, const char* utf8_str) {
-    gotoxy(x, y);
-    textattr(fg, bg);
-    print_utf8(utf8_str);
+inline void print_utf8(int x, int y, ColourSpec fg, ColourSpec bg, const char* utf8_str) {
+    if (Canvas* canvas = recording_canvas()) canvas->print_utf8(x, y, fg, bg, utf8_str);
+    else default_console().print_utf8(x, y, fg, bg, utf8_str);
+}
+
+// Draw prepared text at specified position
+inline void draw(int x, int y, const PreparedText& text) {
+    if (Canvas* canvas = recording_canvas()) canvas->draw(x, y, text);
+    else default_console().draw(x, y, text);
+}
+
+// Draw a prepared box frame at specified position
+inline void draw(int x, int y, const PreparedBox& box) {
+    if (Canvas* canvas = recording_canvas()) canvas->draw(x, y, box);
+    else default_console().draw(x, y, box);
 }
 
 // Get a character (non-blocking on some systems)
 inline int getchar() {
-#ifdef _WIN32
-    return _getch();
-#else
-    int ch = ::getch();
-    return ch;
-#endif
+    return default_console().getchar();
 }
 
 // Get a character with echo
 inline int getcharecho() {
-#ifdef _WIN32
-    return _getche();
-#else
-    // Note: ncurses input in raw mode may need special handling
-    // For now, simply enable echo, read, and disable echo
-    echo();
-    int ch = ::getch();
-    noecho();
-    return ch;
-#endif
+    return default_console().getcharecho();
 }
 
 // Get a wide character (Unicode input)
 inline wint_t getwchar() {
-#ifdef _WIN32
-    wint_t wc = _getwch();
-    return wc;
-#else
-    wint_t wc;
-    get_wch(&wc);
-    return wc;
-#endif
+    return default_console().getwchar();
+}
+
+// Read a key, telling key codes apart from characters
+inline Key getkey() {
+    return default_console().getkey();
 }
 
 // Get a wide character with echo
 inline wint_t getwcharecho() {
-#ifdef _WIN32
-    wint_t wc = _getwche();
-    return wc;
-#else
-    // Note: ncurses input in raw mode may need special handling
-    // For now, simply enable echo, read, and disable echo
-    echo();
-    wint_t wc;
-    get_wch(&wc);
-    noecho();
-    return wc;
-#endif
+    return default_console().getwcharecho();
 }
 
 // Check if key has been pressed
 inline bool kbhit() {
-#ifdef _WIN32
-    return _kbhit() != 0;
-#else
-    nodelay(stdscr, TRUE);
-    int ch = ::getch();
-    nodelay(stdscr, FALSE);
-    
-    if (ch != ERR) {
-        ungetch(ch);
-        return true;
-    }
-    return false;
-#endif
+    return default_console().kbhit();
 }
 
 // Helper function for printf operations
 inline void vprintf_impl(const char* format, va_list args) {
-#ifdef _WIN32
-    vprintf(format, args);
-#else
-    char buffer[4096];
-    vsnprintf(buffer, sizeof(buffer), format, args);
-    printw("%s", buffer);
-    refresh();
-#endif
+    if (Canvas* canvas = recording_canvas()) canvas->vprintf(format, args);
+    else default_console().vprintf(format, args);
 }
 
 // Printf at current position
@@ -495,7 +3491,7 @@ inline void printf(const char* format, ...) {
 // Printf at specified position
 inline void printf(int x, int y, const char* format, ...) {
     gotoxy(x, y);
-    
+
     va_list args;
     va_start(args, format);
     vprintf_impl(format, args);
@@ -503,10 +3499,10 @@ inline void printf(int x, int y, const char* format, ...) {
 }
 
 // Printf at specified position with colour
-inline void printf(int x, int y, Colour fg, Colour bg, const char* format, ...) {
+inline void printf(int x, int y, ColourSpec fg, ColourSpec bg, const char* format, ...) {
     gotoxy(x, y);
     textattr(fg, bg);
-    
+
     va_list args;
     va_start(args, format);
     vprintf_impl(format, args);
@@ -514,10 +3510,10 @@ inline void printf(int x, int y, Colour fg, Colour bg, const char* format, ...)
 }
 
 // Printf at specified position with foreground colour
-inline void printf(int x, int y, Colour fg, const char* format, ...) {
+inline void printf(int x, int y, ColourSpec fg, const char* format, ...) {
     gotoxy(x, y);
     textcolour(fg);
-    
+
     va_list args;
     va_start(args, format);
     vprintf_impl(format, args);
@@ -526,46 +3522,29 @@ inline void printf(int x, int y, Colour fg, const char* format, ...) {
 
 // Get console width
 inline int getwidth() {
-#ifdef _WIN32
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) return 80; // Default width
-    if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return 80;
-    return csbi.srWindow.Right - csbi.srWindow.Left + 1;
-#else
-    int width = 0, height = 0;
-    getmaxyx(stdscr, height, width);
-    (void)height; // height is only needed for getmaxyx macro
-    return width > 0 ? width : 80;
-#endif
+    if (Canvas* canvas = recording_canvas()) return canvas->getwidth();
+    return default_console().getwidth();
 }
 
 // Get console height
 inline int getheight() {
-#ifdef _WIN32
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    if (hConsole == INVALID_HANDLE_VALUE) return 24; // Default height
-    if (!GetConsoleScreenBufferInfo(hConsole, &csbi)) return 24;
-    return csbi.srWindow.Bottom - csbi.srWindow.Top + 1;
-#else
-    int width, height;
-    getmaxyx(stdscr, height, width);
-    return height;
-#endif
+    if (Canvas* canvas = recording_canvas()) return canvas->getheight();
+    return default_console().getheight();
 }
 
 // Show/hide cursor
 inline void showcursor(bool visible) {
-#ifdef _WIN32
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    CONSOLE_CURSOR_INFO cursorInfo;
-    GetConsoleCursorInfo(hConsole, &cursorInfo);
-    cursorInfo.bVisible = visible;
-    SetConsoleCursorInfo(hConsole, &cursorInfo);
-#else
-    curs_set(visible ? 1 : 0);
-#endif
+    default_console().showcursor(visible);
+}
+
+// Display a canvas on the default console
+inline void present(const Canvas& frame) {
+    default_console().present(frame);
+}
+
+// Pick up a change of the default console's size
+inline bool check_resize() {
+    return default_console().check_resize();
 }
 
 } // namespace conio
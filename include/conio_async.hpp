@@ -0,0 +1,323 @@
+#ifndef CONIO_ASYNC_HPP
+#define CONIO_ASYNC_HPP
+
+// Coroutine interface for conio (C++20, opt-in). Interactive tools can wait
+// for keys, frames and resizes on one thread without blocking calls:
+//
+//     conio::Task input() {
+//         for (;;) {
+//             conio::Key key = co_await conio::next_key();
+//             ...
+//         }
+//     }
+//
+//     input();
+//     conio::run();
+//
+// Everything is driven by a single-threaded Reactor that sleeps in poll()
+// (WaitForSingleObject on Windows) until input, a resize or the next frame
+// is due. It can also be driven from an existing event loop through
+// poll_fds(), timeout_ms() and dispatch().
+
+#if !(__cplusplus >= 202002L || (defined(_MSVC_LANG) && _MSVC_LANG >= 202002L))
+    #error "conio_async.hpp requires C++20"
+#endif
+
+#include "conio.hpp"
+
+#include <coroutine>
+#include <chrono>
+#include <vector>
+
+#ifndef _WIN32
+    #include <signal.h>
+    #include <fcntl.h>
+#endif
+
+namespace conio {
+
+// Coroutine type for tasks run by a Reactor. A task starts straight away and
+// its frame is freed when it finishes, by returning or by throwing. An
+// exception leaving a task propagates to whoever resumed it, i.e. out of
+// Reactor::dispatch().
+struct Task {
+    struct promise_type {
+        Task get_return_object() noexcept { return Task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() { throw; }
+    };
+};
+
+#ifndef _WIN32
+// Read end of a pipe written by the SIGWINCH handler, so a reactor asleep in
+// poll() wakes up on resize. The handler is installed once per process; a
+// handler that was already installed (e.g. by ncurses) is still called.
+inline int resize_pipe() {
+    static int fds[2] = { -1, -1 };
+    static struct sigaction previous;
+    static std::once_flag once;
+    std::call_once(once, [] {
+        if (pipe(fds) != 0) return;
+        for (int i = 0; i < 2; i++) {
+            fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+            fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+        }
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = [](int sig, siginfo_t* info, void* context) {
+            int saved = errno;
+            ssize_t written = write(fds[1], "", 1);
+            (void)written; // a full pipe already has a wakeup pending
+            errno = saved;
+            if (previous.sa_flags & SA_SIGINFO) {
+                if (previous.sa_sigaction) previous.sa_sigaction(sig, info, context);
+            } else if (previous.sa_handler != SIG_DFL && previous.sa_handler != SIG_IGN) {
+                previous.sa_handler(sig);
+            }
+        };
+        action.sa_flags = SA_SIGINFO | SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGWINCH, &action, &previous);
+    });
+    return fds[0];
+}
+#endif
+
+// Resumes coroutines waiting on one console's keys, frames and resizes.
+// Waiters of each kind are resumed together, in the order they started
+// waiting; a coroutine that waits again while being resumed waits for the
+// following event. If a resumed coroutine throws, the waiters not resumed
+// yet go back to waiting before the exception leaves dispatch().
+class Reactor {
+public:
+    // co_await yields the key, as getkey() would return it
+    struct KeyAwaiter {
+        Reactor& reactor;
+        std::coroutine_handle<> handle;
+        Key key;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            reactor.key_waiters.push_back(this);
+        }
+        Key await_resume() const noexcept { return key; }
+    };
+
+    // co_await yields the frame number
+    struct FrameAwaiter {
+        Reactor& reactor;
+        std::coroutine_handle<> handle;
+        uint64_t frame;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            if (reactor.frame_waiters.empty()) reactor.schedule_frame();
+            reactor.frame_waiters.push_back(this);
+        }
+        uint64_t await_resume() const noexcept { return frame; }
+    };
+
+    // co_await returns once the terminal size has changed; read the new size
+    // with getwidth()/getheight()
+    struct ResizeAwaiter {
+        Reactor& reactor;
+        std::coroutine_handle<> handle;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> h) {
+            handle = h;
+            reactor.resize_waiters.push_back(this);
+        }
+        void await_resume() const noexcept {}
+    };
+
+private:
+    Console& console;
+    std::chrono::steady_clock::duration frame_interval;
+    std::chrono::steady_clock::time_point last_frame_at;
+    std::chrono::steady_clock::time_point next_frame_at;
+    uint64_t frames;
+    bool stopped;
+    std::vector<KeyAwaiter*> key_waiters;
+    std::vector<FrameAwaiter*> frame_waiters;
+    std::vector<ResizeAwaiter*> resize_waiters;
+
+#ifdef _WIN32
+    // Longest wait while only resizes are awaited; the console input handle
+    // is not signalled for window size changes unless window input is on
+    static const int RESIZE_CHECK_MS = 100;
+#endif
+
+    // Time between frames; rates below 1 per second count as 1
+    static std::chrono::steady_clock::duration interval_for(int frames_per_second) {
+        return std::chrono::nanoseconds(1000000000 / (frames_per_second > 0 ? frames_per_second : 1));
+    }
+
+    // Resume each waiter in ready after set(waiter) has stored its result.
+    // Should one throw, the rest are put back at the front of waiters.
+    template <typename Awaiter, typename Set>
+    static void resume_all(std::vector<Awaiter*>& waiters, std::vector<Awaiter*>& ready, Set set) {
+        for (size_t i = 0; i < ready.size(); i++) {
+            set(ready[i]);
+            try {
+                ready[i]->handle.resume();
+            } catch (...) {
+                // The task is left suspended at its final suspend point
+                // when an exception escapes it, so its frame is freed here
+                ready[i]->handle.destroy();
+                waiters.insert(waiters.begin(), ready.begin() + i + 1, ready.end());
+                throw;
+            }
+        }
+    }
+
+    // Frames keep a steady rhythm while they are awaited back to back; after
+    // a pause, or when the loop falls behind, the next one is due at once
+    void schedule_frame() {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        next_frame_at = last_frame_at + frame_interval;
+        if (next_frame_at < now) next_frame_at = now;
+    }
+
+public:
+    explicit Reactor(Console& console, int frames_per_second = 60)
+        : console(console), frame_interval(interval_for(frames_per_second)),
+          last_frame_at(), next_frame_at(), frames(0), stopped(false) {
+        console.check_resize(); // record the starting size
+#ifndef _WIN32
+        resize_pipe();
+#endif
+    }
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    KeyAwaiter next_key() { return KeyAwaiter{*this, nullptr, Key{0, false}}; }
+    FrameAwaiter next_frame() { return FrameAwaiter{*this, nullptr, 0}; }
+    ResizeAwaiter resized() { return ResizeAwaiter{*this, nullptr}; }
+
+    void set_frame_rate(int frames_per_second) {
+        frame_interval = interval_for(frames_per_second);
+    }
+
+    // True when no coroutine is waiting on this reactor
+    bool idle() const { return key_waiters.empty() && frame_waiters.empty() && resize_waiters.empty(); }
+
+    // Milliseconds the caller may sleep before calling dispatch(): 0 if
+    // something is ready now, -1 if only input or a resize can wake us
+    int timeout_ms() {
+        if (!key_waiters.empty() && console.kbhit()) return 0; // already buffered by the console
+        if (frame_waiters.empty()) return -1;
+        std::chrono::steady_clock::duration left = next_frame_at - std::chrono::steady_clock::now();
+        if (left <= std::chrono::steady_clock::duration::zero()) return 0;
+        return static_cast<int>(std::chrono::ceil<std::chrono::milliseconds>(left).count());
+    }
+
+#ifndef _WIN32
+    // Fill fds (room for 2) with the descriptors to wait on for reading, for
+    // callers running their own poll() loop. Returns the number used.
+    int poll_fds(struct pollfd* fds) const {
+        int n = 0;
+        if (!key_waiters.empty()) fds[n++] = { console.input_fd(), POLLIN, 0 };
+        if (!resize_waiters.empty()) fds[n++] = { resize_pipe(), POLLIN, 0 };
+        return n;
+    }
+#endif
+
+    // Resume whatever is ready, without blocking
+    void dispatch() {
+#ifndef _WIN32
+        char drain[64];
+        while (read(resize_pipe(), drain, sizeof(drain)) > 0) {}
+#endif
+        while (!key_waiters.empty() && console.kbhit()) {
+            Key key = console.getkey();
+#ifndef _WIN32
+            if (key.special && key.code == KEY_RESIZE) continue; // reported through resized()
+#endif
+            std::vector<KeyAwaiter*> ready;
+            ready.swap(key_waiters);
+            resume_all(key_waiters, ready, [key](KeyAwaiter* waiter) { waiter->key = key; });
+        }
+        if (!resize_waiters.empty() && console.check_resize()) {
+            std::vector<ResizeAwaiter*> ready;
+            ready.swap(resize_waiters);
+            resume_all(resize_waiters, ready, [](ResizeAwaiter*) {});
+        }
+        if (!frame_waiters.empty() && std::chrono::steady_clock::now() >= next_frame_at) {
+            frames++;
+            last_frame_at = next_frame_at;
+            std::vector<FrameAwaiter*> ready;
+            ready.swap(frame_waiters);
+            resume_all(frame_waiters, ready, [this](FrameAwaiter* waiter) { waiter->frame = frames; });
+        }
+    }
+
+    // Wait for the next event (at most max_wait_ms if not -1) and dispatch
+    // it. Returns false straight away if nothing is waiting.
+    bool run_once(int max_wait_ms = -1) {
+        if (idle()) return false;
+        int timeout = timeout_ms();
+        if (max_wait_ms >= 0 && (timeout < 0 || max_wait_ms < timeout)) timeout = max_wait_ms;
+#ifdef _WIN32
+        if (!resize_waiters.empty() && (timeout < 0 || timeout > RESIZE_CHECK_MS)) timeout = RESIZE_CHECK_MS;
+        if (!key_waiters.empty()) {
+            WaitForSingleObject(console.input_handle(), timeout < 0 ? INFINITE : static_cast<DWORD>(timeout));
+            // Reading through the console also drops records that are not key
+            // presses, which would otherwise keep the handle signalled
+            console.kbhit();
+        } else if (timeout != 0) {
+            Sleep(timeout < 0 ? INFINITE : static_cast<DWORD>(timeout));
+        }
+#else
+        struct pollfd fds[2];
+        int n = poll_fds(fds);
+        if (timeout != 0) poll(fds, n, timeout);
+#endif
+        dispatch();
+        return true;
+    }
+
+    // Dispatch until no coroutine is waiting or stop() is called
+    void run() {
+        stopped = false;
+        while (!stopped && run_once()) {}
+    }
+
+    void stop() { stopped = true; }
+};
+
+// Reactor for the default console
+inline Reactor& reactor() {
+    static Reactor instance(default_console());
+    return instance;
+}
+
+// Wait for the next key on the default console
+inline Reactor::KeyAwaiter next_key() {
+    return reactor().next_key();
+}
+
+// Wait for the next frame tick (60 per second unless changed with
+// reactor().set_frame_rate())
+inline Reactor::FrameAwaiter next_frame() {
+    return reactor().next_frame();
+}
+
+// Wait for the default console to change size
+inline Reactor::ResizeAwaiter resized() {
+    return reactor().resized();
+}
+
+// Run the default reactor until no task is waiting or stop() is called
+inline void run() {
+    reactor().run();
+}
+
+} // namespace conio
+
+#endif // CONIO_ASYNC_HPP
@@ -0,0 +1,432 @@
+#ifndef CONIO_METRICS_HPP
+#define CONIO_METRICS_HPP
+
+// Shared-memory metrics feed. A service publishes named numeric fields into
+// a shared-memory table with a few atomic stores per update; a dashboard
+// (see metrics_viewer.cpp) maps the same table and reads the values in
+// place, with no pipes and no text to format or parse.
+//
+// The table is protected by a seqlock: the single producer makes the
+// sequence number odd while it writes and even again when done, and readers
+// retry if it was odd or changed while they were copying values. Readers
+// never block the producer.
+//
+// This header does not depend on conio.hpp, so producers need no curses.
+// On Linux with glibc older than 2.34, link with -lrt for shm_open.
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sched.h>
+#endif
+
+namespace conio {
+
+// Values are shared between processes, which needs atomics that don't fall
+// back to a lock inside one process
+static_assert(ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "shared metrics need lock-free 32 and 64-bit atomics");
+
+enum class MetricKind : uint32_t {
+    COUNTER, // ever-increasing integer; viewers can show a rate
+    GAUGE,   // integer that goes up and down
+    REAL     // floating point value
+};
+
+// Table layout, version METRICS_VERSION. Readers refuse other versions.
+struct MetricsHeader {
+    std::atomic<uint32_t> magic;
+    std::atomic<uint32_t> version;
+    std::atomic<uint32_t> sequence;   // seqlock: odd while the producer writes
+    std::atomic<uint32_t> generation; // bumped each time a producer takes over the table
+    std::atomic<uint32_t> capacity;   // field slots following the header
+    std::atomic<uint32_t> count;      // fields published so far
+    uint32_t reserved[10];
+};
+
+// One field, a cache line each. The name and kind are written before the
+// field is published and don't change until the next generation.
+struct MetricSlot {
+    char name[52];
+    std::atomic<uint32_t> kind;
+    std::atomic<uint64_t> value; // int64_t, or the bits of a double for REAL
+};
+
+static_assert(sizeof(MetricsHeader) == 64, "MetricsHeader must stay 64 bytes");
+static_assert(sizeof(MetricSlot) == 64, "MetricSlot must stay 64 bytes");
+
+static const uint32_t METRICS_MAGIC = 0x544D4E43; // "CNMT"
+static const uint32_t METRICS_VERSION = 1;
+
+inline size_t metrics_size(uint32_t capacity) {
+    return sizeof(MetricsHeader) + capacity * sizeof(MetricSlot);
+}
+
+// Shared memory object name for a feed: "/name" for shm_open, or a
+// session-local mapping name on Windows
+inline std::string metrics_object_name(const char* name) {
+#ifdef _WIN32
+    return std::string("Local\\conio-metrics-") + name;
+#else
+    return name[0] == '/' ? std::string(name) : std::string("/") + name;
+#endif
+}
+
+inline uint64_t metric_bits(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+inline double metric_real(uint64_t bits) {
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// Producer side. Only one writer per feed: updates are plain stores
+// bracketed by the seqlock, with no read-modify-write on shared memory.
+class MetricsWriter {
+private:
+    MetricsHeader* header;
+    MetricSlot* slots;
+    size_t mapped_size;
+    uint32_t sequence; // our copy of header->sequence
+    int batch_depth;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+
+    void begin_write() {
+        header->sequence.store(++sequence, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void end_write() {
+        header->sequence.store(++sequence, std::memory_order_release);
+    }
+
+    // True for ids returned by field(); anything else would write into the
+    // header or an unpublished slot
+    bool valid(int id) const {
+        return header && id >= 0 && static_cast<uint32_t>(id) < header->count.load(std::memory_order_relaxed);
+    }
+
+public:
+    // Create the feed, or take over an existing one of the same name (left
+    // by an earlier run). Readers that have it mapped see the new fields.
+    explicit MetricsWriter(const char* name, uint32_t capacity = 64)
+        : header(nullptr), slots(nullptr), mapped_size(0), sequence(0), batch_depth(0) {
+        std::string object = metrics_object_name(name);
+        size_t size = metrics_size(capacity);
+#ifdef _WIN32
+        mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+                                     static_cast<DWORD>(size), object.c_str());
+        if (!mapping) return;
+        void* view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+        if (!view) return;
+        // An existing section keeps the size it was created with
+        MEMORY_BASIC_INFORMATION info;
+        if (VirtualQuery(view, &info, sizeof(info)) && info.RegionSize < size) size = info.RegionSize;
+#else
+        int fd = shm_open(object.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return;
+        struct stat st;
+        // Only ever grow the object: readers may still map the old size
+        if (fstat(fd, &st) != 0 || (static_cast<size_t>(st.st_size) < size && ftruncate(fd, size) != 0)) {
+            close(fd);
+            return;
+        }
+        if (static_cast<size_t>(st.st_size) > size) size = st.st_size;
+        void* view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (view == MAP_FAILED) return;
+#endif
+        header = static_cast<MetricsHeader*>(view);
+        slots = reinterpret_cast<MetricSlot*>(header + 1);
+        mapped_size = size;
+
+        // Carry on from the previous producer's sequence so readers notice
+        sequence = header->sequence.load(std::memory_order_relaxed) | 1;
+        header->sequence.store(sequence, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        header->count.store(0, std::memory_order_relaxed);
+        header->capacity.store(static_cast<uint32_t>((size - sizeof(MetricsHeader)) / sizeof(MetricSlot)),
+                               std::memory_order_relaxed);
+        header->generation.store(header->generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        header->version.store(METRICS_VERSION, std::memory_order_relaxed);
+        header->magic.store(METRICS_MAGIC, std::memory_order_relaxed);
+        end_write();
+    }
+
+    // Leaves the feed in place so viewers keep the final values; see remove()
+    ~MetricsWriter() {
+#ifdef _WIN32
+        if (header) UnmapViewOfFile(header);
+        if (mapping) CloseHandle(mapping);
+#else
+        if (header) munmap(header, mapped_size);
+#endif
+    }
+
+    MetricsWriter(const MetricsWriter&) = delete;
+    MetricsWriter& operator=(const MetricsWriter&) = delete;
+
+    bool is_open() const { return header != nullptr; }
+
+    // Delete a feed by name (Windows frees it when the last handle closes)
+    static void remove(const char* name) {
+#ifndef _WIN32
+        shm_unlink(metrics_object_name(name).c_str());
+#else
+        (void)name;
+#endif
+    }
+
+    // Publish a field and return its id, or -1 if the table is full. Names
+    // longer than 51 bytes are truncated.
+    int field(const char* name, MetricKind kind = MetricKind::GAUGE) {
+        if (!header) return -1;
+        uint32_t id = header->count.load(std::memory_order_relaxed);
+        if (id >= header->capacity.load(std::memory_order_relaxed)) return -1;
+        MetricSlot& slot = slots[id];
+        if (batch_depth == 0) begin_write();
+        strncpy(slot.name, name, sizeof(slot.name) - 1);
+        slot.name[sizeof(slot.name) - 1] = '\0';
+        slot.kind.store(static_cast<uint32_t>(kind), std::memory_order_relaxed);
+        slot.value.store(kind == MetricKind::REAL ? metric_bits(0.0) : 0, std::memory_order_relaxed);
+        header->count.store(id + 1, std::memory_order_release);
+        if (batch_depth == 0) end_write();
+        return static_cast<int>(id);
+    }
+
+    // Group several updates so readers see them together
+    void begin() {
+        if (header && batch_depth++ == 0) begin_write();
+    }
+
+    void commit() {
+        if (header && --batch_depth == 0) end_write();
+    }
+
+    // Updates to an id that field() did not return (such as the -1 for a
+    // full table) are ignored
+    void set(int id, int64_t value) {
+        if (!valid(id)) return;
+        if (batch_depth == 0) begin_write();
+        slots[id].value.store(static_cast<uint64_t>(value), std::memory_order_relaxed);
+        if (batch_depth == 0) end_write();
+    }
+
+    void set_real(int id, double value) {
+        if (!valid(id)) return;
+        if (batch_depth == 0) begin_write();
+        slots[id].value.store(metric_bits(value), std::memory_order_relaxed);
+        if (batch_depth == 0) end_write();
+    }
+
+    // Add to an integer field; we are the only writer, so no atomic add is needed
+    void add(int id, int64_t delta) {
+        if (!valid(id)) return;
+        set(id, static_cast<int64_t>(slots[id].value.load(std::memory_order_relaxed)) + delta);
+    }
+};
+
+// Reader side. update() takes a consistent snapshot of the values; names
+// and kinds are only copied again when fields are added or a new producer
+// takes over the feed.
+class MetricsReader {
+private:
+    std::string object;
+    const MetricsHeader* header;
+    const MetricSlot* slots;
+    size_t mapped_size;
+    uint32_t mapped_capacity;
+#ifdef _WIN32
+    HANDLE mapping;
+#else
+    dev_t device;
+    ino_t inode;
+#endif
+    uint32_t last_sequence;
+    uint32_t last_generation;
+    std::vector<std::string> names_;
+    std::vector<MetricKind> kinds_;
+    std::vector<uint64_t> values_;
+
+    // Attempts at a consistent snapshot before giving up until the next call
+    static const int MAX_RETRIES = 64;
+
+    void unmap() {
+#ifdef _WIN32
+        if (header) UnmapViewOfFile(header);
+        if (mapping) CloseHandle(mapping);
+        mapping = NULL;
+#else
+        if (header) munmap(const_cast<MetricsHeader*>(header), mapped_size);
+#endif
+        header = nullptr;
+        slots = nullptr;
+    }
+
+    bool map() {
+#ifdef _WIN32
+        mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, object.c_str());
+        if (!mapping) return false;
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        MEMORY_BASIC_INFORMATION info;
+        if (!view || !VirtualQuery(view, &info, sizeof(info))) {
+            if (view) UnmapViewOfFile(view);
+            CloseHandle(mapping);
+            mapping = NULL;
+            return false;
+        }
+        size_t size = info.RegionSize;
+#else
+        int fd = shm_open(object.c_str(), O_RDONLY, 0);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(MetricsHeader)) {
+            close(fd);
+            return false;
+        }
+        size_t size = st.st_size;
+        void* view = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (view == MAP_FAILED) return false;
+        device = st.st_dev;
+        inode = st.st_ino;
+#endif
+        header = static_cast<const MetricsHeader*>(view);
+        slots = reinterpret_cast<const MetricSlot*>(header + 1);
+        mapped_size = size;
+        mapped_capacity = static_cast<uint32_t>((size - sizeof(MetricsHeader)) / sizeof(MetricSlot));
+        if (header->magic.load(std::memory_order_acquire) != METRICS_MAGIC ||
+            header->version.load(std::memory_order_relaxed) != METRICS_VERSION) {
+            unmap();
+            return false;
+        }
+        last_generation = header->generation.load(std::memory_order_relaxed) - 1; // force a name refresh
+        return true;
+    }
+
+public:
+    // Open the feed; if the producer hasn't started yet, call open() again later
+    explicit MetricsReader(const char* name)
+        : object(metrics_object_name(name)), header(nullptr), slots(nullptr), mapped_size(0), mapped_capacity(0),
+#ifdef _WIN32
+          mapping(NULL),
+#else
+          device(0), inode(0),
+#endif
+          last_sequence(1), last_generation(0) {
+        map();
+    }
+
+    ~MetricsReader() { unmap(); }
+
+    MetricsReader(const MetricsReader&) = delete;
+    MetricsReader& operator=(const MetricsReader&) = delete;
+
+    bool is_open() const { return header != nullptr; }
+
+    // (Re)open the feed by name. Also picks up a feed that was deleted and
+    // created again since it was opened.
+    bool open() {
+        unmap();
+        last_sequence = 1;
+        names_.clear();
+        kinds_.clear();
+        values_.clear();
+        return map();
+    }
+
+    // True if the name now refers to a different feed than the one mapped,
+    // e.g. after a producer removed it and a new one was started
+    bool replaced() const {
+#ifdef _WIN32
+        return false; // a section lives as long as anyone has it open
+#else
+        int fd = shm_open(object.c_str(), O_RDONLY, 0);
+        if (fd < 0) return false;
+        struct stat st;
+        bool different = fstat(fd, &st) == 0 && (st.st_dev != device || st.st_ino != inode);
+        close(fd);
+        return different;
+#endif
+    }
+
+    // Take a snapshot of the values. Returns true if anything changed since
+    // the previous snapshot; false if nothing changed or the producer kept
+    // the table busy for every attempt.
+    bool update() {
+        if (!header) return false;
+        if (header->sequence.load(std::memory_order_acquire) == last_sequence) return false;
+        for (int attempt = 0; attempt < MAX_RETRIES; attempt++) {
+            uint32_t before = header->sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+#ifdef _WIN32
+                YieldProcessor();
+#else
+                sched_yield();
+#endif
+                continue;
+            }
+            uint32_t generation = header->generation.load(std::memory_order_relaxed);
+            uint32_t count = header->count.load(std::memory_order_acquire);
+            uint32_t capacity = header->capacity.load(std::memory_order_relaxed);
+            if (capacity > mapped_capacity) {
+                // A later producer grew the table beyond our mapping
+                return open() && update();
+            }
+            if (count > capacity) continue;
+            bool renamed = generation != last_generation || count != names_.size();
+            if (renamed) {
+                names_.resize(count);
+                kinds_.resize(count);
+                for (uint32_t i = 0; i < count; i++) {
+                    names_[i].assign(slots[i].name, strnlen(slots[i].name, sizeof(slots[i].name)));
+                    kinds_[i] = static_cast<MetricKind>(slots[i].kind.load(std::memory_order_relaxed));
+                }
+            }
+            values_.resize(count);
+            for (uint32_t i = 0; i < count; i++) {
+                values_[i] = slots[i].value.load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->sequence.load(std::memory_order_relaxed) != before) continue;
+            last_sequence = before;
+            last_generation = generation;
+            return true;
+        }
+        return false;
+    }
+
+    // Producer restarts seen, for viewers that keep per-field history
+    uint32_t generation() const { return last_generation; }
+
+    // Fields in the last snapshot
+    size_t size() const { return values_.size(); }
+    const std::string& name(size_t i) const { return names_[i]; }
+    MetricKind kind(size_t i) const { return kinds_[i]; }
+    int64_t integer(size_t i) const { return static_cast<int64_t>(values_[i]); }
+    double real(size_t i) const { return metric_real(values_[i]); }
+    double value(size_t i) const {
+        return kinds_[i] == MetricKind::REAL ? real(i) : static_cast<double>(integer(i));
+    }
+};
+
+} // namespace conio
+
+#endif // CONIO_METRICS_HPP
@@ -0,0 +1,58 @@
+// Test producer for the shared-memory metrics feed: publishes a few fields
+// and updates them about a thousand times a second, standing in for a real
+// service. Watch it with metrics_viewer.
+//
+// Usage: metrics_producer [feed-name] [seconds]   (0 seconds runs forever)
+
+#include "conio_metrics.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <thread>
+#include <chrono>
+
+int main(int argc, char** argv) {
+    const char* name = argc > 1 ? argv[1] : "conio-demo";
+    int seconds = argc > 2 ? atoi(argv[2]) : 60;
+
+    conio::MetricsWriter feed(name);
+    if (!feed.is_open()) {
+        fprintf(stderr, "metrics_producer: cannot create feed '%s'\n", name);
+        return 1;
+    }
+
+    int requests = feed.field("requests", conio::MetricKind::COUNTER);
+    int errors = feed.field("errors", conio::MetricKind::COUNTER);
+    int bytes_out = feed.field("bytes_out", conio::MetricKind::COUNTER);
+    int in_flight = feed.field("in_flight");
+    int queue_depth = feed.field("queue_depth");
+    int latency = feed.field("latency_ms", conio::MetricKind::REAL);
+    int cpu = feed.field("cpu_percent", conio::MetricKind::REAL);
+
+    printf("Publishing to feed '%s'%s\n", name, seconds > 0 ? "" : " until interrupted");
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point end = start + std::chrono::seconds(seconds);
+    unsigned long long updates = 0;
+    while (seconds <= 0 || std::chrono::steady_clock::now() < end) {
+        double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        int served = 1 + rand() % 5;
+
+        // One batch, so the viewer never sees requests without their bytes
+        feed.begin();
+        feed.add(requests, served);
+        feed.add(bytes_out, served * (512 + rand() % 4096));
+        if (rand() % 200 == 0) feed.add(errors, 1);
+        feed.set(in_flight, 20 + static_cast<int64_t>(15 * sin(t)));
+        feed.set(queue_depth, rand() % 8);
+        feed.set_real(latency, 4.0 + 2.5 * sin(t / 3) + (rand() % 100) / 100.0);
+        feed.set_real(cpu, 35.0 + 20.0 * sin(t / 7));
+        feed.commit();
+        updates++;
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    printf("Published %llu updates\n", updates);
+    return 0;
+}
@@ -0,0 +1,103 @@
+// Dashboard for a shared-memory metrics feed (see include/conio_metrics.hpp).
+// Values are read straight from the producer's table; the screen is drawn
+// into a canvas and present() only sends the cells that changed.
+//
+// Usage: metrics_viewer [feed-name]   (q or Esc to quit)
+
+#include "conio.hpp"
+#include "conio_metrics.hpp"
+#include <thread>
+#include <chrono>
+
+int main(int argc, char** argv) {
+    const char* name = argc > 1 ? argv[1] : "conio-demo";
+
+    conio::init();
+    conio::showcursor(false);
+
+    conio::MetricsReader feed(name);
+    conio::Canvas frame(conio::getwidth(), conio::getheight());
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point last_change = Clock::now();
+    Clock::time_point last_sample = Clock::now();
+    std::vector<double> sampled; // counter values at the last rate sample
+    std::vector<double> rates;   // per second, counters only
+    uint32_t sampled_generation = 0;
+    bool dirty = true;
+
+    for (;;) {
+        if (conio::kbhit()) {
+            int key = conio::getchar();
+            if (key == 'q' || key == 'Q' || key == 27) break;
+        }
+        if (conio::check_resize()) {
+            frame.resize(conio::getwidth(), conio::getheight());
+            dirty = true;
+        }
+
+        Clock::time_point now = Clock::now();
+        // A quiet feed may have been replaced by a restarted producer
+        if (!feed.is_open() || (now - last_change > std::chrono::seconds(1) && feed.replaced())) {
+            if (feed.open()) dirty = true;
+            last_change = now;
+        }
+        if (feed.update()) {
+            last_change = now;
+            dirty = true;
+        }
+
+        // Counter rates, once a second
+        double elapsed = std::chrono::duration<double>(now - last_sample).count();
+        if (elapsed >= 1.0) {
+            if (feed.generation() != sampled_generation || sampled.size() != feed.size()) {
+                sampled.assign(feed.size(), 0.0);
+                rates.assign(feed.size(), -1.0); // no rate until two samples exist
+                for (size_t i = 0; i < feed.size(); i++) sampled[i] = feed.value(i);
+                sampled_generation = feed.generation();
+            } else {
+                for (size_t i = 0; i < feed.size(); i++) {
+                    rates[i] = (feed.value(i) - sampled[i]) / elapsed;
+                    sampled[i] = feed.value(i);
+                }
+            }
+            last_sample = now;
+            dirty = true;
+        }
+
+        if (dirty) {
+            frame.resetattr();
+            frame.clrscr();
+            frame.printf(0, 0, conio::Colour::BRIGHT_WHITE, conio::Colour::BLUE, " Metrics: %-*s",
+                         frame.getwidth() > 11 ? frame.getwidth() - 11 : 0, name);
+            frame.resetattr();
+            if (!feed.is_open()) {
+                frame.printf(2, 2, conio::Colour::YELLOW, "Waiting for a producer on '%s'...", name);
+            } else {
+                frame.printf(2, 2, conio::Colour::BRIGHT_CYAN, "%-32s %18s %16s", "Field", "Value", "Rate");
+                for (size_t i = 0; i < feed.size() && static_cast<int>(i) + 3 < frame.getheight() - 1; i++) {
+                    int y = 3 + static_cast<int>(i);
+                    frame.printf(2, y, conio::Colour::WHITE, "%-32.32s", feed.name(i).c_str());
+                    if (feed.kind(i) == conio::MetricKind::REAL) {
+                        frame.printf(35, y, conio::Colour::BRIGHT_GREEN, "%18.3f", feed.real(i));
+                    } else {
+                        frame.printf(35, y, conio::Colour::BRIGHT_GREEN, "%18lld",
+                                     static_cast<long long>(feed.integer(i)));
+                    }
+                    if (feed.kind(i) == conio::MetricKind::COUNTER && i < rates.size() && rates[i] >= 0) {
+                        frame.printf(54, y, conio::Colour::BRIGHT_YELLOW, "%14.1f/s", rates[i]);
+                    }
+                }
+            }
+            frame.printf(0, frame.getheight() - 1, conio::Colour::BRIGHT_BLACK, "q: quit");
+            conio::present(frame);
+            dirty = false;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    conio::showcursor(true);
+    conio::cleanup();
+    return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef CONIO_TESTS_CHECK_HPP
+#define CONIO_TESTS_CHECK_HPP
+
+// Helpers shared by the test programs in this directory. Each test is a
+// standalone program: CHECK() reports a failed condition and carries on, and
+// main() ends with `return report("test_name");`.
+
+#include <cstdio>
+#include <string>
+
+#ifndef _WIN32
+    #include <pty.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+inline int& check_failures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            check_failures()++; \
+        } \
+    } while (0)
+
+// Print the outcome; the exit status for main()
+inline int report(const char* name) {
+    if (check_failures()) {
+        fprintf(stderr, "%s: %d check(s) failed\n", name, check_failures());
+        return 1;
+    }
+    printf("%s: ok\n", name);
+    return 0;
+}
+
+#ifndef _WIN32
+// Open a cols x rows pty. Reads from master don't block, so drain() returns
+// as soon as everything written so far has been read.
+inline bool open_pty(int& master, int& slave, int cols = 40, int rows = 10) {
+    struct winsize size = { static_cast<unsigned short>(rows), static_cast<unsigned short>(cols), 0, 0 };
+    if (openpty(&master, &slave, nullptr, nullptr, &size) != 0) {
+        perror("openpty");
+        check_failures()++;
+        return false;
+    }
+    fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+    return true;
+}
+
+// Everything written to the terminal since the last call
+inline std::string drain(int master) {
+    std::string out;
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(master, buf, sizeof(buf))) > 0) out.append(buf, static_cast<size_t>(n));
+    return out;
+}
+#endif
+
+// Text left once escape sequences are removed
+inline std::string visible(const std::string& out) {
+    std::string text;
+    for (size_t i = 0; i < out.size(); i++) {
+        if (out[i] != '\x1b') {
+            text += out[i];
+        } else if (i + 1 < out.size() && out[i + 1] == '[') {
+            for (i += 2; i < out.size() && (out[i] < 0x40 || out[i] > 0x7E); i++) {}
+        } else {
+            for (i++; i < out.size() && out[i] >= 0x20 && out[i] <= 0x2F; i++) {}
+        }
+    }
+    return text;
+}
+
+#endif // CONIO_TESTS_CHECK_HPP
@@ -0,0 +1,136 @@
+// Checks that recycling a colour pair keeps the colours of what is already
+// on screen. TERM=xterm has 64 pairs, so the console can use 63. A large
+// xterm-256color screen then cycles through every palette combination.
+//
+// g++ -std=c++11 -I include tests/test_colour_pairs.cpp -o test_colour_pairs -lncursesw -lutil -pthread
+
+#include "conio.hpp"
+#include "check.hpp"
+#include <clocale>
+#include <cstdio>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <unistd.h>
+
+static const int COMBOS = 63;
+
+// Colours ncurses will show for a cell of the console's screen, which stays
+// selected after each call on the console
+static void cell_colours(int x, int y, int& fg, int& bg) {
+    cchar_t cc;
+    wchar_t wc[CCHARW_MAX + 1];
+    attr_t attrs;
+    short pair = 0;
+    int cur_y, cur_x;
+    getyx(stdscr, cur_y, cur_x);
+    mvwin_wch(stdscr, y, x, &cc);
+    wmove(stdscr, cur_y, cur_x);
+#if defined(NCURSES_EXT_COLORS)
+    int ext_pair = 0;
+    getcchar(&cc, wc, &attrs, &pair, &ext_pair);
+    extended_pair_content(ext_pair, &fg, &bg);
+#else
+    getcchar(&cc, wc, &attrs, &pair, nullptr);
+    short f, b;
+    pair_content(pair, &f, &b);
+    fg = f;
+    bg = b;
+#endif
+}
+
+// Combination i of the eight dark colours, drawn as one cell at (x, y).
+// Combination 7 is white on black, the colours of the blank cells.
+static void draw_combo(conio::Canvas& frame, int i, int x, int y) {
+    frame.textcolour(static_cast<conio::Colour>(i % 8));
+    frame.textbackground(static_cast<conio::Colour>(i / 8));
+    frame.gotoxy(x, y);
+    frame.putch('#');
+}
+
+int main() {
+    setlocale(LC_ALL, "C.UTF-8");
+
+    int master, slave;
+    if (!open_pty(master, slave)) return 1;
+
+    conio::Console con(slave, slave, "xterm");
+    CHECK(con.is_open());
+    if (!con.is_open()) return 1;
+
+    // Use every pair, one cell each
+    conio::Canvas frame(40, 10);
+    for (int i = 0; i < COMBOS; i++) draw_combo(frame, i, i % 32, i / 32);
+    con.present(frame);
+    drain(master);
+    CHECK(con.stats().pair_evictions == 0);
+
+    int fg[COMBOS], bg[COMBOS];
+    for (int i = 0; i < COMBOS; i++) cell_colours(i % 32, i / 32, fg[i], bg[i]);
+
+    // A 64th combination replacing the newest cell: the only pair free to
+    // recycle is the one that cell used, not the least recently used one
+    draw_combo(frame, COMBOS, (COMBOS - 1) % 32, (COMBOS - 1) / 32);
+    uint64_t written = con.stats().cells_written;
+    con.present(frame);
+    CHECK(con.stats().pair_evictions == 1);
+    CHECK(con.stats().cells_written == written + 1);
+    CHECK(drain(master).size() < 64);
+    for (int i = 0; i < COMBOS - 1; i++) {
+        int f, b;
+        cell_colours(i % 32, i / 32, f, b);
+        CHECK(f == fg[i] && b == bg[i]);
+    }
+
+    // Nothing was repainted, so the next identical frame still sends nothing
+    con.present(frame);
+    CHECK(drain(master).empty());
+
+#if defined(NCURSES_EXT_COLORS)
+    // 400x120 cells, each in its own combination of the 256-colour palette,
+    // shifted by 20000 combinations a frame: pairs are recycled every frame
+    // without touching what is on screen or forcing a full repaint
+    const int cols = 400, rows = 120, cells = cols * rows;
+    int big_master, big_slave;
+    if (!open_pty(big_master, big_slave, cols, rows)) return 1;
+    std::atomic<bool> done(false);
+    std::thread reader([&]() {
+        char buffer[65536];
+        while (!done) {
+            if (read(big_master, buffer, sizeof(buffer)) <= 0) usleep(1000);
+        }
+    });
+    {
+        conio::Console big(big_slave, big_slave, "xterm-256color");
+        CHECK(big.is_open() && big.getwidth() == cols && big.getheight() == rows);
+        conio::Canvas screen(cols, rows);
+        for (int k = 0; k < 4; k++) {
+            for (int i = 0; i < cells; i++) {
+                int combo = (k * 20000 + i) % 65536;
+                screen.textattr(conio::Colour256{ static_cast<uint8_t>(combo % 256) },
+                                conio::Colour256{ static_cast<uint8_t>(combo / 256) });
+                screen.putch(i % cols, i / cols, '#');
+            }
+            big.present(screen);
+            uint64_t written = big.stats().cells_written;
+            big.present(screen);
+            CHECK(big.stats().cells_written == written);
+
+            int wrong = 0;
+            for (int i = 0; i < cells; i += 97) {
+                int combo = (k * 20000 + i) % 65536;
+                if (combo % 256 < 16 || combo / 256 < 16) continue;
+                int f, b;
+                cell_colours(i % cols, i / cols, f, b);
+                if (f != combo % 256 || b != combo / 256) wrong++;
+            }
+            CHECK(wrong == 0);
+        }
+        CHECK(big.stats().pair_evictions > 0);
+    }
+    done = true;
+    reader.join();
+#endif
+
+    return report("test_colour_pairs");
+}
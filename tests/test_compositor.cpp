@@ -0,0 +1,102 @@
+// Checks that panes drawn on worker threads through the free functions inside
+// a DrawScope are merged by Compositor in z order and clipped to the frame.
+//
+// g++ -std=c++11 -I include tests/test_compositor.cpp -o test_compositor -lncursesw -pthread
+
+#include "conio.hpp"
+#include "check.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Pane {
+    int x, y, width, height, z;
+    char letter;
+    conio::Colour fg;
+};
+
+// Fill a layer with its letter using only the free drawing functions
+void fill_pane(conio::Layer& layer, const Pane& pane) {
+    conio::DrawScope scope(layer.canvas);
+    conio::textattr(pane.fg, conio::Colour::BLUE);
+    conio::clrscr();
+    std::string line(pane.width, pane.letter);
+    for (int row = 0; row < pane.height; row++) conio::printf(0, row, "%s", line.c_str());
+}
+
+// The cell a pane's letter should produce, drawn the same way on the main thread
+conio::Cell expected_cell(const Pane& pane) {
+    conio::Canvas canvas(1, 1);
+    canvas.textattr(pane.fg, conio::Colour::BLUE);
+    canvas.putch(0, 0, pane.letter);
+    return canvas.at(0, 0);
+}
+
+} // namespace
+
+int main() {
+    const int width = 16, height = 6;
+    // Listed in the order the layers are added
+    const Pane panes[] = {
+        { 0, 0, 10, 3, 0, 'a', conio::Colour::RED },    // bottom
+        { 4, 1, 8, 3, 1, 'b', conio::Colour::GREEN },   // over a
+        { 6, 0, 4, 3, 1, 'c', conio::Colour::YELLOW },  // same z as b, added later
+        { -3, 4, 6, 4, 2, 'd', conio::Colour::CYAN },   // off the left and bottom
+        { 13, -1, 6, 3, -1, 'e', conio::Colour::WHITE } // off the top and right, under nothing
+    };
+    const int count = sizeof(panes) / sizeof(panes[0]);
+
+    conio::Compositor compositor;
+    std::vector<conio::Layer*> layers;
+    for (int i = 0; i < count; i++) {
+        const Pane& p = panes[i];
+        layers.push_back(&compositor.add_layer(p.x, p.y, p.width, p.height, p.z));
+    }
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < count; i++) workers.push_back(std::thread(fill_pane, std::ref(*layers[i]), panes[i]));
+    for (size_t i = 0; i < workers.size(); i++) workers[i].join();
+
+    // The main thread was never redirected
+    CHECK(conio::recording_canvas() == nullptr);
+
+    const conio::Canvas& frame = compositor.compose(width, height);
+    CHECK(frame.getwidth() == width && frame.getheight() == height);
+
+    // Expected owner of each cell: the last pane covering it in
+    // (z, insertion) order, or none
+    conio::Canvas blank(1, 1);
+    int mismatches = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int owner = -1;
+            for (int i = 0; i < count; i++) {
+                const Pane& p = panes[i];
+                if (x < p.x || x >= p.x + p.width || y < p.y || y >= p.y + p.height) continue;
+                if (owner < 0 || p.z >= panes[owner].z) owner = i;
+            }
+            conio::Cell want = owner < 0 ? blank.at(0, 0) : expected_cell(panes[owner]);
+            if (frame.at(x, y) != want) mismatches++;
+        }
+    }
+    CHECK(mismatches == 0);
+
+    // Spot checks: equal z keeps insertion order, higher z wins, clipping
+    CHECK(frame.at(7, 1).glyph == 'c'); // b and c overlap, c added later
+    CHECK(frame.at(5, 1).glyph == 'b'); // b over a
+    CHECK(frame.at(1, 1).glyph == 'a');
+    CHECK(frame.at(0, 5).glyph == 'd'); // only frame columns 0..2 show d
+    CHECK(frame.at(3, 5).glyph == ' ');
+    CHECK(frame.at(15, 1).glyph == 'e'); // e's row 2 lands on frame row 1
+    CHECK(frame.at(15, 2).glyph == ' ');
+
+    // Raising a layer and composing again changes the order
+    layers[0]->z = 5;
+    const conio::Canvas& raised = compositor.compose(width, height);
+    CHECK(raised.at(7, 1).glyph == 'a');
+    CHECK(raised.at(10, 1).glyph == 'b');
+
+    return report("test_compositor");
+}
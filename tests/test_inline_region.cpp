@@ -0,0 +1,67 @@
+// Checks that InlineRegion writes output held back by its redraw interval
+// once the interval is up, without another call on the region, and that
+// drawing races neither the timer nor other threads logging (build with
+// -fsanitize=thread to have the race detector confirm it).
+//
+// g++ -std=c++11 -I include tests/test_inline_region.cpp -o test_inline_region -lncursesw -lutil -pthread
+
+#include "conio.hpp"
+#include "check.hpp"
+#include <clocale>
+#include <cstdio>
+#include <string>
+#include <thread>
+
+int main() {
+    setlocale(LC_ALL, "C.UTF-8");
+
+    int master, slave;
+    if (!open_pty(master, slave)) return 1;
+
+    {
+        conio::InlineRegion region(1, slave, 50);
+        region.set_line(0, "first");
+        CHECK(drain(master).find("first") != std::string::npos);
+
+        // Inside the interval: held back, then written by the timer
+        region.set_line(0, "second");
+        region.log("logged");
+        CHECK(drain(master).empty());
+        std::this_thread::sleep_for(std::chrono::milliseconds(150));
+        std::string out = drain(master);
+        CHECK(out.find("second") != std::string::npos);
+        CHECK(out.find("logged") != std::string::npos);
+
+        // Nothing pending, nothing written
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        CHECK(drain(master).empty());
+
+        region.set_line(0, "third");
+    }
+    // The destructor writes what was still held back
+    CHECK(drain(master).find("third") != std::string::npos);
+
+    // Frames drawn through draw() while another thread logs and the timer
+    // flushes whatever the short interval held back
+    {
+        conio::InlineRegion region(2, slave, 1);
+        std::thread logger([&region]() {
+            for (int i = 0; i < 200; i++) {
+                region.logf("log %d", i);
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+            }
+        });
+        for (int i = 0; i < 2000; i++) {
+            region.draw([i](conio::Canvas& lines) {
+                lines.printf(0, 0, conio::Colour::GREEN, "frame %d", i);
+                lines.printf(0, 1, conio::Rgb{ 255, 160, 0 }, "%d%%", i / 20);
+            });
+            drain(master);
+        }
+        logger.join();
+    }
+    std::string last = drain(master);
+    CHECK(last.find("frame 1999") != std::string::npos);
+
+    return report("test_inline_region");
+}
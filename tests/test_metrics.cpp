@@ -0,0 +1,74 @@
+// Stress test for the shared-memory metrics feed: a producer thread updates
+// two fields together as fast as it can while the main thread reads them,
+// and every snapshot must hold a matching pair. Also checks that updates to
+// ids outside the table (the -1 returned for a full table) are ignored.
+//
+// g++ -std=c++11 -O2 -I include tests/test_metrics.cpp -o test_metrics -pthread
+// Usage: test_metrics [seconds]
+
+#include "conio_metrics.hpp"
+#include "check.hpp"
+#include <cstdlib>
+#include <atomic>
+#include <thread>
+#include <chrono>
+
+int main(int argc, char** argv) {
+    const char* name = "conio-test-metrics";
+    int seconds = argc > 1 ? atoi(argv[1]) : 2;
+    if (seconds < 1) seconds = 1;
+
+    conio::MetricsWriter::remove(name);
+    conio::MetricsWriter feed(name, 2);
+    CHECK(feed.is_open());
+    if (!feed.is_open()) return report("test_metrics");
+    int a = feed.field("a");
+    int b = feed.field("b", conio::MetricKind::COUNTER);
+    int full = feed.field("c");
+    CHECK(full == -1);
+
+    // Out-of-range ids must leave the header and the fields alone
+    feed.set(a, 1);
+    feed.set(b, 2);
+    feed.set(full, -1);
+    feed.set_real(-2, 1e300);
+    feed.add(2, 12345);
+    feed.set(1000000, -1);
+
+    conio::MetricsReader reader(name);
+    CHECK(reader.is_open());
+    CHECK(reader.update());
+    CHECK(reader.size() == 2);
+    if (reader.size() == 2) {
+        CHECK(reader.integer(0) == 1);
+        CHECK(reader.integer(1) == 2);
+        CHECK(reader.kind(1) == conio::MetricKind::COUNTER);
+    }
+
+    // Torn reads: the producer always stores b = 2a in one batch
+    std::atomic<bool> done(false);
+    std::thread producer([&] {
+        for (int64_t i = 0; !done.load(std::memory_order_relaxed); i++) {
+            feed.begin();
+            feed.set(a, i);
+            feed.set(b, 2 * i);
+            feed.commit();
+            if (i % 64 == 0) std::this_thread::yield();
+        }
+    });
+
+    long snapshots = 0, torn = 0;
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    while (std::chrono::steady_clock::now() < end) {
+        if (!reader.update()) continue;
+        snapshots++;
+        if (reader.integer(1) != 2 * reader.integer(0)) torn++;
+    }
+    done = true;
+    producer.join();
+
+    CHECK(snapshots > 0);
+    CHECK(torn == 0);
+    conio::MetricsWriter::remove(name);
+    return report("test_metrics");
+}
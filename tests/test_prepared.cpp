@@ -0,0 +1,72 @@
+// Checks PreparedText and PreparedBox: widths measured without any locale
+// set, box layout, and the bytes prepared for each colour depth.
+//
+// g++ -std=c++11 -I include tests/test_prepared.cpp -o test_prepared -lncursesw
+
+#include "conio.hpp"
+#include "check.hpp"
+#include <string>
+
+// Built during static initialisation, before anything could call setlocale()
+static const conio::PreparedText title("Requests \xE2\x9C\x85"); // ends in U+2705
+
+int main() {
+    // Widths: a wide emoji, wide CJK, and a letter with a combining mark
+    // grouped into one cell, all in the C locale
+    CHECK(title.width() == 11);
+    CHECK(title.cells()[9].glyph == 0x2705 && title.cells()[10].glyph == 0);
+    CHECK(title.wide() == L"Requests \x2705");
+    CHECK(visible(title.bytes(conio::ColourDepth::TRUECOLOUR)) == "Requests \xE2\x9C\x85");
+
+    conio::PreparedText cjk("\xE6\x97\xA5\xE6\x9C\xAC"); // 日本
+    CHECK(cjk.width() == 4);
+    conio::PreparedText accent("e\xCC\x81x"); // e + combining acute, x
+    CHECK(accent.width() == 2);
+    CHECK(conio::glyph_text(accent.cells()[0].glyph) == "e\xCC\x81");
+    CHECK(accent.cells()[1].glyph == 'x');
+    CHECK(accent.wide() == L"e\x0301x");
+
+    // Bytes at each depth, with and without the terminal's default colours
+    conio::PreparedText red("ab", conio::Rgb{ 255, 0, 0 }, conio::Colour::BLACK);
+    const char* expected[4][2] = {
+        { "\x1b[0;31;40mab\x1b[0m", "\x1b[0;31mab\x1b[0m" },
+        { "\x1b[0;91;40mab\x1b[0m", "\x1b[0;91mab\x1b[0m" },
+        { "\x1b[0;38;5;196;40mab\x1b[0m", "\x1b[0;38;5;196mab\x1b[0m" },
+        { "\x1b[0;38;2;255;0;0;40mab\x1b[0m", "\x1b[0;38;2;255;0;0mab\x1b[0m" },
+    };
+    for (int depth = 0; depth < 4; depth++) {
+        for (int defaults = 0; defaults < 2; defaults++) {
+            CHECK(red.bytes(static_cast<conio::ColourDepth>(depth), defaults != 0) == expected[depth][defaults]);
+        }
+    }
+    conio::PreparedText plain("hi");
+    CHECK(plain.bytes(conio::ColourDepth::COLOURS_256) == "\x1b[0;37;40mhi\x1b[0m");
+    CHECK(plain.bytes(conio::ColourDepth::COLOURS_256, true) == "\x1b[0mhi\x1b[0m");
+
+    // One style throughout, so one run
+    CHECK(red.runs().size() == 1 && red.runs()[0].length == 2);
+
+    // Box layout: edges, corners and sides, with and without fill
+    conio::PreparedBox box(6, 4, conio::BoxStyle::ROUNDED, conio::Colour::CYAN);
+    CHECK(box.top().width() == 6 && box.bottom().width() == 6 && box.middle().width() == 6);
+    CHECK(box.side().width() == 1);
+    conio::Canvas canvas(10, 6);
+    canvas.print_utf8(0, 0, "##########");
+    canvas.print_utf8(0, 2, "##########");
+    canvas.draw(2, 1, box);
+    CHECK(canvas.at(2, 1).glyph == 0x256D && canvas.at(7, 1).glyph == 0x256E); // ╭ ╮
+    CHECK(canvas.at(2, 4).glyph == 0x2570 && canvas.at(7, 4).glyph == 0x256F); // ╰ ╯
+    CHECK(canvas.at(3, 1).glyph == 0x2500 && canvas.at(6, 4).glyph == 0x2500); // ─
+    CHECK(canvas.at(2, 2).glyph == 0x2502 && canvas.at(7, 3).glyph == 0x2502); // │
+    CHECK(canvas.at(4, 2).glyph == '#');  // interior left alone without fill
+    CHECK(canvas.at(1, 2).glyph == '#' && canvas.at(8, 2).glyph == '#');
+    CHECK(canvas.at(8, 1).glyph == ' ');
+
+    conio::PreparedBox filled(6, 4, conio::BoxStyle::ASCII, conio::Colour::WHITE, conio::Colour::BLACK, true);
+    canvas.draw(2, 1, filled);
+    CHECK(canvas.at(2, 1).glyph == '+' && canvas.at(3, 1).glyph == '-' && canvas.at(2, 2).glyph == '|');
+    CHECK(canvas.at(4, 2).glyph == ' '); // interior cleared with fill
+    CHECK(canvas.at(1, 2).glyph == '#');
+
+    return report("test_prepared");
+}
@@ -0,0 +1,55 @@
+// Checks that present() only sends what changed, with two consoles on
+// separate ptys showing the same canvas.
+//
+// g++ -std=c++11 -I include tests/test_present.cpp -o test_present -lncursesw -lutil
+
+#include "conio.hpp"
+#include "check.hpp"
+#include <clocale>
+#include <cstdio>
+#include <string>
+
+int main() {
+    setlocale(LC_ALL, "C.UTF-8");
+
+    int master[2], slave[2];
+    for (int i = 0; i < 2; i++) {
+        if (!open_pty(master[i], slave[i])) return 1;
+    }
+
+    conio::Console a(slave[0], slave[0], "xterm-256color");
+    conio::Console b(slave[1], slave[1], "xterm-256color");
+    CHECK(a.is_open() && b.is_open());
+    if (!a.is_open() || !b.is_open()) return 1;
+
+    conio::Canvas frame(40, 10);
+    frame.printf(1, 1, conio::Colour::BRIGHT_GREEN, "hello %d", 42);
+    frame.print_utf8(1, 2, "日本 ✅");
+
+    conio::Console* consoles[2] = { &a, &b };
+    for (int i = 0; i < 2; i++) {
+        conio::Console& con = *consoles[i];
+        con.present(frame);
+        drain(master[i]);
+        uint64_t written = con.stats().cells_written;
+
+        // An identical frame sends nothing
+        con.present(frame);
+        CHECK(con.stats().cells_written == written);
+        CHECK(drain(master[i]).empty());
+        CHECK(con.stats().frames_presented == 2);
+    }
+
+    // One changed cell is all that reaches either terminal
+    frame.printf(7, 1, conio::Colour::BRIGHT_GREEN, "3");
+    for (int i = 0; i < 2; i++) {
+        conio::Console& con = *consoles[i];
+        uint64_t written = con.stats().cells_written;
+        con.present(frame);
+        CHECK(con.stats().cells_written == written + 1);
+        std::string out = drain(master[i]);
+        CHECK(visible(out) == "3");
+    }
+
+    return report("test_present");
+}
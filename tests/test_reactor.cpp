@@ -0,0 +1,88 @@
+// Checks the coroutine reactor: next_key() tells key codes apart from
+// characters (U+019A has the same value as KEY_RESIZE but is still delivered
+// as a character), a task that throws does not strand the other waiters, and
+// a frame rate of 0 is accepted.
+//
+// g++ -std=c++20 -I include tests/test_reactor.cpp -o test_reactor -lncursesw -lutil
+
+#include "conio_async.hpp"
+#include "check.hpp"
+#include <clocale>
+#include <cstdio>
+#include <vector>
+
+static std::vector<conio::Key> keys;
+
+static conio::Task read_keys(conio::Reactor& reactor, size_t count) {
+    while (keys.size() < count) keys.push_back(co_await reactor.next_key());
+    reactor.stop();
+}
+
+static conio::Task throw_on_key(conio::Reactor& reactor) {
+    co_await reactor.next_key();
+    throw 42;
+}
+
+// Read three keys (a, U+019A, cursor down) through a reactor on a fresh pty
+static void read_three(bool inline_mode) {
+    int master, slave;
+    if (!open_pty(master, slave)) return;
+    conio::InitConfig config;
+    config.inline_mode = inline_mode;
+    conio::Console con(slave, slave, "xterm-256color", config);
+    CHECK(con.is_open());
+
+    // Cursor down as xterm sends it in keypad mode
+    const char input[] = "a\xc6\x9a\x1bOB";
+    ssize_t sent = write(master, input, sizeof(input) - 1);
+    CHECK(sent == static_cast<ssize_t>(sizeof(input) - 1));
+
+    keys.clear();
+    conio::Reactor reactor(con);
+    read_keys(reactor, 3);
+    for (int i = 0; i < 20 && !reactor.idle(); i++) reactor.run_once(100);
+
+    CHECK(keys.size() == 3);
+    if (keys.size() == 3) {
+        CHECK(!keys[0].special && keys[0].code == 'a');
+        CHECK(!keys[1].special && keys[1].code == 0x19A);
+        CHECK(keys[2].special && keys[2].code == KEY_DOWN);
+    }
+    close(master);
+}
+
+// A throwing task leaves the waiters after it waiting for the next key
+static void rethrow() {
+    int master, slave;
+    if (!open_pty(master, slave)) return;
+    conio::Console con(slave, slave, "xterm-256color");
+    conio::Reactor reactor(con, 0);
+    reactor.set_frame_rate(0);
+
+    keys.clear();
+    throw_on_key(reactor);
+    read_keys(reactor, 1);
+    ssize_t sent = write(master, "xy", 2);
+    CHECK(sent == 2);
+
+    bool thrown = false;
+    try {
+        for (int i = 0; i < 20 && !reactor.idle(); i++) reactor.run_once(100);
+    } catch (int) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    CHECK(!reactor.idle());
+    for (int i = 0; i < 20 && !reactor.idle(); i++) reactor.run_once(100);
+    CHECK(keys.size() == 1 && keys[0].code == 'y');
+    close(master);
+}
+
+int main() {
+    setlocale(LC_ALL, "C.UTF-8");
+    read_three(false);
+    read_three(true);
+    rethrow();
+
+    return report("test_reactor");
+}
@@ -0,0 +1,89 @@
+// Checks that reclaim_shared_tables() frees style and grapheme entries no
+// canvas uses any more, keeps the ones still drawn, and that freed indices
+// are never handed back for a different value.
+//
+// g++ -std=c++11 -I include tests/test_shared_tables.cpp -o test_shared_tables -lncursesw -pthread
+
+#include "conio.hpp"
+#include "check.hpp"
+#include <string>
+#include <thread>
+
+namespace {
+
+conio::Rgb rgb(int i) {
+    conio::Rgb c = { static_cast<uint8_t>(i), static_cast<uint8_t>(i >> 8), 7 };
+    return c;
+}
+
+} // namespace
+
+int main() {
+    conio::Canvas kept(8, 1);
+    kept.textcolour(rgb(1));
+    kept.print_utf8(0, 0, "e\xCC\x81"); // e + combining acute
+    conio::PreparedText label("a\xCC\x88", rgb(2)); // a + combining diaeresis
+
+    size_t styles_before = conio::style_table().size();
+    size_t glyphs_before = conio::grapheme_table().size();
+
+    // A frame of throwaway RGB colours and clusters, drawn one codepoint at a
+    // time so every prefix of each cluster is interned
+    {
+        conio::Canvas scratch(100, 10);
+        for (int i = 0; i < 1000; i++) {
+            scratch.textcolour(rgb(1000 + i));
+            scratch.gotoxy(i % 100, i / 100);
+            scratch.putwch(L'o');
+            for (int k = 0; k <= i % 3; k++) scratch.putwch(static_cast<wchar_t>(0x0300 + (i / 3) % 64 + k));
+        }
+        CHECK(conio::style_table().size() >= styles_before + 1000);
+        CHECK(conio::grapheme_table().size() > glyphs_before);
+    }
+
+    uint32_t generation = conio::shared_table_generation().load();
+    size_t freed = conio::reclaim_shared_tables();
+    CHECK(freed >= 1000);
+    CHECK(conio::shared_table_generation().load() != generation);
+    CHECK(conio::style_table().size() <= styles_before);
+    CHECK(conio::grapheme_table().size() <= glyphs_before);
+
+    // Freed styles are not served from this thread's lookup cache once their
+    // indices have been handed to other styles. Another thread takes the
+    // indices so this thread's cache keeps its entries; the newest style is
+    // looked up first since it is certain to still be cached.
+    conio::Canvas fresh(100, 10), old(100, 10);
+    std::thread other([&fresh]() {
+        for (int i = 0; i < 1000; i++) {
+            fresh.textcolour(rgb(5000 + i));
+            fresh.putch(i % 100, i / 100, 'x');
+        }
+    });
+    other.join();
+    int wrong = 0;
+    for (int i = 999; i >= 0; i--) {
+        old.textcolour(rgb(1000 + i));
+        old.putch(i % 100, i / 100, 'y');
+        if (conio::style_table()[old.at(i % 100, i / 100).style].fg != conio::ColourSpec(rgb(1000 + i))) wrong++;
+    }
+    CHECK(wrong == 0);
+
+    // What is still drawn is untouched
+    conio::Canvas expect(8, 1);
+    expect.textcolour(rgb(1));
+    expect.print_utf8(0, 0, "e\xCC\x81");
+    CHECK(kept.at(0, 0) == expect.at(0, 0));
+    CHECK(conio::glyph_text(kept.at(0, 0).glyph) == "e\xCC\x81");
+    CHECK(conio::style_table()[kept.at(0, 0).style].fg == conio::ColourSpec(rgb(1)));
+    CHECK(conio::glyph_text(label.cells()[0].glyph) == "a\xCC\x88");
+    CHECK(conio::style_table()[label.cells()[0].style].fg == conio::ColourSpec(rgb(2)));
+
+    // wputs interns only whole clusters
+    size_t glyphs = conio::grapheme_table().size();
+    conio::Canvas again(2, 1);
+    again.wputs(0, 0, L"u\x0308\x0301");
+    CHECK(conio::grapheme_table().size() == glyphs + 1);
+    CHECK(conio::glyph_text(again.at(0, 0).glyph) == "u\xCC\x88\xCC\x81");
+
+    return report("test_shared_tables");
+}